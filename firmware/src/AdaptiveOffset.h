@@ -0,0 +1,118 @@
+#pragma once
+
+// Gyro offset correction that learns quickly after boot. FusionOffset uses a
+// 0.02 Hz cutoff and waits for 5 s of stillness for its whole life, so a fresh
+// unit takes minutes to learn its bias. This drives the same algorithm but
+// starts with a high cutoff and short timeout, then anneals the cutoff down to
+// FusionOffset's steady-state value while the sensor is still. Once there it
+// behaves exactly like plain FusionOffset.
+
+#include "Fusion.h"
+#include <math.h>
+
+// starting cutoff (Hz) and stillness timeout (s)
+#define ADAPTIVE_OFFSET_INITIAL_CUTOFF 1.0f
+#define ADAPTIVE_OFFSET_INITIAL_TIMEOUT 0.5f
+// time constant of the cutoff decay - seconds of stillness
+#define ADAPTIVE_OFFSET_ANNEAL_TIME 2.0f
+// treat the cutoff as converged once it's within this factor of steady state
+#define ADAPTIVE_OFFSET_CONVERGED_RATIO 1.1f
+
+enum OffsetConvergence {
+  // haven't been still long enough to start learning
+  OFFSET_WAITING,
+  // learning with a cutoff above steady state
+  OFFSET_CONVERGING,
+  // running at FusionOffset's normal cutoff and timeout
+  OFFSET_CONVERGED,
+};
+
+class AdaptiveOffset {
+private:
+  FusionOffset offset;
+  unsigned int sampleRate;
+  // FusionOffset's own coefficient and timeout for this sample rate
+  float steadyCoefficient;
+  unsigned int steadyTimeout;
+  // per-sample decay of the excess coefficient
+  float annealFactor;
+  OffsetConvergence state;
+
+public:
+  AdaptiveOffset(unsigned int sampleRate) {
+    this->sampleRate = sampleRate;
+    FusionOffsetInitialise(&offset, sampleRate);
+    steadyCoefficient = offset.filterCoefficient;
+    steadyTimeout = offset.timeout;
+    annealFactor = expf(-1.0f / (ADAPTIVE_OFFSET_ANNEAL_TIME * sampleRate));
+    reset();
+  }
+
+  // forget the bias and start learning fast again
+  void reset() {
+    FusionOffsetInitialise(&offset, sampleRate);
+    offset.filterCoefficient = 2.0f * (float)M_PI * ADAPTIVE_OFFSET_INITIAL_CUTOFF / (float)sampleRate;
+    offset.timeout = (unsigned int)(ADAPTIVE_OFFSET_INITIAL_TIMEOUT * sampleRate);
+    state = OFFSET_WAITING;
+  }
+
+  // the sensor's output data rate changed - FusionOffset counts in samples, so
+  // it's set up again for the new rate (Hz) with the same steady-state cutoff
+  // and timeout. The bias doesn't depend on the rate and is kept; the cutoff
+  // anneals down again from the start.
+  void setSampleRate(unsigned int sampleRate) {
+    const float cutoffHz = steadyCoefficient * this->sampleRate / (2.0f * (float)M_PI);
+    const float timeoutSeconds = (float)steadyTimeout / this->sampleRate;
+    const FusionVector bias = offset.gyroscopeOffset;
+    this->sampleRate = sampleRate;
+    annealFactor = expf(-1.0f / (ADAPTIVE_OFFSET_ANNEAL_TIME * sampleRate));
+    setSteadyState(cutoffHz, timeoutSeconds);
+    reset();
+    offset.gyroscopeOffset = bias;
+  }
+
+  // replace FusionOffset's steady-state cutoff (Hz) and stillness timeout (s)
+  // - tools/fusion_tune searches these
+  void setSteadyState(float cutoffHz, float timeoutSeconds) {
+    steadyCoefficient = 2.0f * (float)M_PI * cutoffHz / (float)sampleRate;
+    steadyTimeout = (unsigned int)(timeoutSeconds * sampleRate);
+    if (state == OFFSET_CONVERGED) {
+      offset.filterCoefficient = steadyCoefficient;
+      offset.timeout = steadyTimeout;
+    }
+  }
+
+  FusionVector update(const FusionVector gyroscope) {
+    const FusionVector corrected = FusionOffsetUpdate(&offset, gyroscope);
+    // FusionOffset only adjusts the bias once the timer has run out
+    if (state != OFFSET_CONVERGED && offset.timer >= offset.timeout) {
+      state = OFFSET_CONVERGING;
+      offset.filterCoefficient = steadyCoefficient + (offset.filterCoefficient - steadyCoefficient) * annealFactor;
+      if (offset.filterCoefficient < steadyCoefficient * ADAPTIVE_OFFSET_CONVERGED_RATIO) {
+        offset.filterCoefficient = steadyCoefficient;
+        offset.timeout = steadyTimeout;
+        state = OFFSET_CONVERGED;
+      }
+    }
+    return corrected;
+  }
+
+  OffsetConvergence getState() {
+    return state;
+  }
+
+  // current cutoff frequency - Hz
+  float getCutoffFrequency() {
+    return offset.filterCoefficient * sampleRate / (2.0f * (float)M_PI);
+  }
+
+  // current bias estimate - deg/s
+  FusionVector getBias() {
+    return offset.gyroscopeOffset;
+  }
+
+  // samples the gyro has been stationary for
+  unsigned int getTimer() {
+    return offset.timer;
+  }
+};
@@ -0,0 +1,354 @@
+#pragma once
+
+// Batch version of FusionAhrsUpdateNoMagnetometer for several IMUs on one
+// device. The filter states of all sensors are held in structure-of-arrays
+// layout and the floating point work is done for 4 or 8 sensors at a time
+// with SSE2, AVX2 or NEON. Targets without float SIMD (including the
+// ESP32-S3, whose PIE extension only has integer vector ops) fall back to
+// plain loops over the arrays, which the compiler can still pipeline.
+//
+// The maths mirrors FusionAhrs.c operation for operation so each lane gives
+// the same result as a scalar FusionAhrs with the same settings (to within
+// rounding where the compiler contracts multiply-adds differently). The
+// integer/boolean bookkeeping (initialisation ramp, angular rate recovery,
+// acceleration rejection and recovery) is done per lane between the vector
+// passes since it is cheap and branchy.
+
+#include "Fusion.h"
+#include <float.h>
+#include <math.h>
+#include <stdint.h>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+// Minimal float vector abstraction used by AhrsBatch
+struct AhrsVec {
+#if defined(__AVX2__)
+  typedef __m256 type;
+  static const int width = 8;
+  static type load(const float *p) { return _mm256_load_ps(p); }
+  static void store(float *p, type v) { _mm256_store_ps(p, v); }
+  static type set1(float f) { return _mm256_set1_ps(f); }
+  static type add(type a, type b) { return _mm256_add_ps(a, b); }
+  static type sub(type a, type b) { return _mm256_sub_ps(a, b); }
+  static type mul(type a, type b) { return _mm256_mul_ps(a, b); }
+  // lanes where a < b are taken from ifTrue
+  static type selectLess(type a, type b, type ifTrue, type ifFalse) {
+    return _mm256_blendv_ps(ifFalse, ifTrue, _mm256_cmp_ps(a, b, _CMP_LT_OQ));
+  }
+  static type fastInverseSqrt(type x) {
+    const __m256i i = _mm256_sub_epi32(_mm256_set1_epi32(0x5F1F1412), _mm256_srai_epi32(_mm256_castps_si256(x), 1));
+    const type f = _mm256_castsi256_ps(i);
+    return mul(f, sub(set1(1.69000231f), mul(mul(mul(set1(0.714158168f), x), f), f)));
+  }
+#elif defined(__SSE2__)
+  typedef __m128 type;
+  static const int width = 4;
+  static type load(const float *p) { return _mm_load_ps(p); }
+  static void store(float *p, type v) { _mm_store_ps(p, v); }
+  static type set1(float f) { return _mm_set1_ps(f); }
+  static type add(type a, type b) { return _mm_add_ps(a, b); }
+  static type sub(type a, type b) { return _mm_sub_ps(a, b); }
+  static type mul(type a, type b) { return _mm_mul_ps(a, b); }
+  static type selectLess(type a, type b, type ifTrue, type ifFalse) {
+    const type mask = _mm_cmplt_ps(a, b);
+    return _mm_or_ps(_mm_and_ps(mask, ifTrue), _mm_andnot_ps(mask, ifFalse));
+  }
+  static type fastInverseSqrt(type x) {
+    const __m128i i = _mm_sub_epi32(_mm_set1_epi32(0x5F1F1412), _mm_srai_epi32(_mm_castps_si128(x), 1));
+    const type f = _mm_castsi128_ps(i);
+    return mul(f, sub(set1(1.69000231f), mul(mul(mul(set1(0.714158168f), x), f), f)));
+  }
+#elif defined(__ARM_NEON)
+  typedef float32x4_t type;
+  static const int width = 4;
+  static type load(const float *p) { return vld1q_f32(p); }
+  static void store(float *p, type v) { vst1q_f32(p, v); }
+  static type set1(float f) { return vdupq_n_f32(f); }
+  static type add(type a, type b) { return vaddq_f32(a, b); }
+  static type sub(type a, type b) { return vsubq_f32(a, b); }
+  static type mul(type a, type b) { return vmulq_f32(a, b); }
+  static type selectLess(type a, type b, type ifTrue, type ifFalse) {
+    return vbslq_f32(vcltq_f32(a, b), ifTrue, ifFalse);
+  }
+  static type fastInverseSqrt(type x) {
+    const int32x4_t i = vsubq_s32(vdupq_n_s32(0x5F1F1412), vshrq_n_s32(vreinterpretq_s32_f32(x), 1));
+    const type f = vreinterpretq_f32_s32(i);
+    return mul(f, sub(set1(1.69000231f), mul(mul(mul(set1(0.714158168f), x), f), f)));
+  }
+#else
+  typedef float type;
+  static const int width = 1;
+  static type load(const float *p) { return *p; }
+  static void store(float *p, type v) { *p = v; }
+  static type set1(float f) { return f; }
+  static type add(type a, type b) { return a + b; }
+  static type sub(type a, type b) { return a - b; }
+  static type mul(type a, type b) { return a * b; }
+  static type selectLess(type a, type b, type ifTrue, type ifFalse) { return a < b ? ifTrue : ifFalse; }
+  static type fastInverseSqrt(type x) { return FusionFastInverseSqrt(x); }
+#endif
+};
+
+// N is the number of sensors. Fill in the input arrays for lanes 0..N-1, call
+// update() and read the orientation back with getQuaternion(lane).
+template <int N>
+class AhrsBatch {
+public:
+  static const int width = AhrsVec::width;
+  // arrays are padded to a whole number of vectors
+  static const int capacity = (N + width - 1) / width * width;
+
+  // inputs - gyroscope in deg/s, accelerometer in g, delta time in seconds
+  alignas(32) float gx[capacity];
+  alignas(32) float gy[capacity];
+  alignas(32) float gz[capacity];
+  alignas(32) float ax[capacity];
+  alignas(32) float ay[capacity];
+  alignas(32) float az[capacity];
+  alignas(32) float deltaTime[capacity];
+
+private:
+  // settings converted the same way as FusionAhrsSetSettings
+  float gain;
+  float gyroscopeRange;
+  float accelerationRejection;
+  int recoveryTriggerPeriod;
+  float rampedGainStep;
+  // +1 for NWU/ENU, -1 for NED (half gravity is negated)
+  float gravitySign;
+
+  // per lane state
+  alignas(32) float qw[capacity];
+  alignas(32) float qx[capacity];
+  alignas(32) float qy[capacity];
+  alignas(32) float qz[capacity];
+  alignas(32) float halfFeedbackX[capacity];
+  alignas(32) float halfFeedbackY[capacity];
+  alignas(32) float halfFeedbackZ[capacity];
+  // gain applied to the accelerometer feedback this update (0 if ignored)
+  alignas(32) float feedbackGain[capacity];
+  alignas(32) float rampedGain[capacity];
+  bool initialising[capacity];
+  bool angularRateRecovery[capacity];
+  bool accelerometerIgnored[capacity];
+  int accelerationRecoveryTrigger[capacity];
+  int accelerationRecoveryTimeout[capacity];
+
+  // per update scratch written by the vector passes
+  alignas(32) float newFeedbackX[capacity];
+  alignas(32) float newFeedbackY[capacity];
+  alignas(32) float newFeedbackZ[capacity];
+  alignas(32) float newFeedbackMagnitudeSquared[capacity];
+
+  void resetLane(int lane) {
+    qw[lane] = 1.0f;
+    qx[lane] = 0.0f;
+    qy[lane] = 0.0f;
+    qz[lane] = 0.0f;
+    initialising[lane] = true;
+    rampedGain[lane] = 10.0f; // INITIAL_GAIN in FusionAhrs.c
+    angularRateRecovery[lane] = false;
+    halfFeedbackX[lane] = 0.0f;
+    halfFeedbackY[lane] = 0.0f;
+    halfFeedbackZ[lane] = 0.0f;
+    accelerometerIgnored[lane] = false;
+    accelerationRecoveryTrigger[lane] = 0;
+    accelerationRecoveryTimeout[lane] = recoveryTriggerPeriod;
+  }
+
+  static int clamp(int value, int min, int max) {
+    return value < min ? min : (value > max ? max : value);
+  }
+
+  // gyroscope range check and initialisation gain ramp
+  void updateLaneStates() {
+    for (int i = 0; i < N; i++) {
+      if (fabsf(gx[i]) > gyroscopeRange || fabsf(gy[i]) > gyroscopeRange || fabsf(gz[i]) > gyroscopeRange) {
+        const float w = qw[i], x = qx[i], y = qy[i], z = qz[i];
+        resetLane(i);
+        qw[i] = w;
+        qx[i] = x;
+        qy[i] = y;
+        qz[i] = z;
+        angularRateRecovery[i] = true;
+      }
+      if (initialising[i]) {
+        rampedGain[i] -= rampedGainStep * deltaTime[i];
+        if (rampedGain[i] < gain || gain == 0.0f) {
+          rampedGain[i] = gain;
+          initialising[i] = false;
+          angularRateRecovery[i] = false;
+        }
+      }
+    }
+  }
+
+  // accelerometer feedback for every lane
+  void computeFeedback() {
+    typedef AhrsVec V;
+    const V::type half = V::set1(0.5f);
+    const V::type sign = V::set1(gravitySign);
+    for (int i = 0; i < capacity; i += width) {
+      const V::type w = V::load(qw + i), x = V::load(qx + i), y = V::load(qy + i), z = V::load(qz + i);
+      // direction of gravity indicated by the algorithm, scaled by 0.5
+      const V::type hgx = V::mul(sign, V::sub(V::mul(x, z), V::mul(w, y)));
+      const V::type hgy = V::mul(sign, V::add(V::mul(y, z), V::mul(w, x)));
+      const V::type hgz = V::mul(sign, V::add(V::sub(V::mul(w, w), half), V::mul(z, z)));
+
+      // normalised accelerometer
+      V::type sx = V::load(ax + i), sy = V::load(ay + i), sz = V::load(az + i);
+      const V::type sNorm = V::fastInverseSqrt(V::add(V::add(V::mul(sx, sx), V::mul(sy, sy)), V::mul(sz, sz)));
+      sx = V::mul(sx, sNorm);
+      sy = V::mul(sy, sNorm);
+      sz = V::mul(sz, sNorm);
+
+      // feedback - cross product, normalised if the error is >90 degrees
+      V::type fx = V::sub(V::mul(sy, hgz), V::mul(sz, hgy));
+      V::type fy = V::sub(V::mul(sz, hgx), V::mul(sx, hgz));
+      V::type fz = V::sub(V::mul(sx, hgy), V::mul(sy, hgx));
+      const V::type dot = V::add(V::add(V::mul(sx, hgx), V::mul(sy, hgy)), V::mul(sz, hgz));
+      const V::type fNorm = V::fastInverseSqrt(V::add(V::add(V::mul(fx, fx), V::mul(fy, fy)), V::mul(fz, fz)));
+      const V::type zero = V::set1(0.0f);
+      fx = V::selectLess(dot, zero, V::mul(fx, fNorm), fx);
+      fy = V::selectLess(dot, zero, V::mul(fy, fNorm), fy);
+      fz = V::selectLess(dot, zero, V::mul(fz, fNorm), fz);
+      V::store(newFeedbackX + i, fx);
+      V::store(newFeedbackY + i, fy);
+      V::store(newFeedbackZ + i, fz);
+      V::store(newFeedbackMagnitudeSquared + i,
+               V::add(V::add(V::mul(fx, fx), V::mul(fy, fy)), V::mul(fz, fz)));
+    }
+  }
+
+  // acceleration rejection and recovery
+  void updateRejection() {
+    for (int i = 0; i < capacity; i++) {
+      feedbackGain[i] = 0.0f;
+      accelerometerIgnored[i] = true;
+      if (i >= N || (ax[i] == 0.0f && ay[i] == 0.0f && az[i] == 0.0f)) {
+        continue;
+      }
+      halfFeedbackX[i] = newFeedbackX[i];
+      halfFeedbackY[i] = newFeedbackY[i];
+      halfFeedbackZ[i] = newFeedbackZ[i];
+      if (initialising[i] || newFeedbackMagnitudeSquared[i] <= accelerationRejection) {
+        accelerometerIgnored[i] = false;
+        accelerationRecoveryTrigger[i] -= 9;
+      } else {
+        accelerationRecoveryTrigger[i] += 1;
+      }
+      if (accelerationRecoveryTrigger[i] > accelerationRecoveryTimeout[i]) {
+        accelerationRecoveryTimeout[i] = 0;
+        accelerometerIgnored[i] = false;
+      } else {
+        accelerationRecoveryTimeout[i] = recoveryTriggerPeriod;
+      }
+      accelerationRecoveryTrigger[i] = clamp(accelerationRecoveryTrigger[i], 0, recoveryTriggerPeriod);
+      if (!accelerometerIgnored[i]) {
+        feedbackGain[i] = rampedGain[i];
+      }
+    }
+  }
+
+  // apply feedback to the gyroscope and integrate the quaternion
+  void integrate() {
+    typedef AhrsVec V;
+    const V::type halfDegreesToRadians = V::set1(FusionDegreesToRadians(0.5f));
+    for (int i = 0; i < capacity; i += width) {
+      // feedback gain is zero when the accelerometer is ignored, which is the
+      // same as adding a zero feedback vector
+      const V::type k = V::load(feedbackGain + i);
+      const V::type dt = V::load(deltaTime + i);
+      const V::type hx = V::mul(V::add(V::mul(V::load(gx + i), halfDegreesToRadians),
+                                       V::mul(V::load(halfFeedbackX + i), k)), dt);
+      const V::type hy = V::mul(V::add(V::mul(V::load(gy + i), halfDegreesToRadians),
+                                       V::mul(V::load(halfFeedbackY + i), k)), dt);
+      const V::type hz = V::mul(V::add(V::mul(V::load(gz + i), halfDegreesToRadians),
+                                       V::mul(V::load(halfFeedbackZ + i), k)), dt);
+      const V::type w = V::load(qw + i), x = V::load(qx + i), y = V::load(qy + i), z = V::load(qz + i);
+      // q = q + q * h
+      const V::type nw = V::add(w, V::sub(V::sub(V::mul(V::sub(V::set1(0.0f), x), hx), V::mul(y, hy)), V::mul(z, hz)));
+      const V::type nx = V::add(x, V::sub(V::add(V::mul(w, hx), V::mul(y, hz)), V::mul(z, hy)));
+      const V::type ny = V::add(y, V::add(V::sub(V::mul(w, hy), V::mul(x, hz)), V::mul(z, hx)));
+      const V::type nz = V::add(z, V::sub(V::add(V::mul(w, hz), V::mul(x, hy)), V::mul(y, hx)));
+      const V::type norm =
+          V::fastInverseSqrt(V::add(V::add(V::add(V::mul(nw, nw), V::mul(nx, nx)), V::mul(ny, ny)), V::mul(nz, nz)));
+      V::store(qw + i, V::mul(nw, norm));
+      V::store(qx + i, V::mul(nx, norm));
+      V::store(qy + i, V::mul(ny, norm));
+      V::store(qz + i, V::mul(nz, norm));
+    }
+  }
+
+  // zero heading during initialisation, as FusionAhrsUpdateNoMagnetometer does
+  void zeroInitialisingHeadings() {
+    for (int i = 0; i < N; i++) {
+      if (!initialising[i]) continue;
+      const FusionQuaternion q = getQuaternion(i);
+      const float yaw = atan2f(q.element.w * q.element.z + q.element.x * q.element.y,
+                               0.5f - q.element.y * q.element.y - q.element.z * q.element.z);
+      const float halfYaw = 0.5f * yaw;
+      const FusionQuaternion rotation = {.element = {.w = cosf(halfYaw), .x = 0.0f, .y = 0.0f, .z = -1.0f * sinf(halfYaw)}};
+      const FusionQuaternion result = FusionQuaternionMultiply(rotation, q);
+      qw[i] = result.element.w;
+      qx[i] = result.element.x;
+      qy[i] = result.element.y;
+      qz[i] = result.element.z;
+    }
+  }
+
+public:
+  AhrsBatch(const FusionAhrsSettings &settings) {
+    gain = settings.gain;
+    gyroscopeRange = settings.gyroscopeRange == 0.0f ? FLT_MAX : 0.98f * settings.gyroscopeRange;
+    accelerationRejection = settings.accelerationRejection == 0.0f
+                                ? FLT_MAX
+                                : powf(0.5f * sinf(FusionDegreesToRadians(settings.accelerationRejection)), 2);
+    recoveryTriggerPeriod = (int)settings.recoveryTriggerPeriod;
+    if (settings.gain == 0.0f || settings.recoveryTriggerPeriod == 0) {
+      accelerationRejection = FLT_MAX;
+    }
+    rampedGainStep = (10.0f - settings.gain) / 3.0f; // INITIAL_GAIN, INITIALISATION_PERIOD
+    gravitySign = settings.convention == FusionConventionNed ? -1.0f : 1.0f;
+    for (int i = 0; i < capacity; i++) {
+      resetLane(i);
+      // padding lanes see a stationary level sensor
+      gx[i] = gy[i] = gz[i] = 0.0f;
+      ax[i] = ay[i] = 0.0f;
+      az[i] = 1.0f;
+      deltaTime[i] = 0.0f;
+    }
+  }
+
+  void reset(int lane) { resetLane(lane); }
+
+  void update() {
+    updateLaneStates();
+    computeFeedback();
+    updateRejection();
+    integrate();
+    zeroInitialisingHeadings();
+  }
+
+  FusionQuaternion getQuaternion(int lane) const {
+    const FusionQuaternion q = {.element = {.w = qw[lane], .x = qx[lane], .y = qy[lane], .z = qz[lane]}};
+    return q;
+  }
+
+  FusionAhrsFlags getFlags(int lane) const {
+    FusionAhrsFlags flags = {};
+    flags.initialising = initialising[lane];
+    flags.angularRateRecovery = angularRateRecovery[lane];
+    flags.accelerationRecovery = accelerationRecoveryTrigger[lane] > accelerationRecoveryTimeout[lane];
+    return flags;
+  }
+
+  bool isAccelerometerIgnored(int lane) const { return accelerometerIgnored[lane]; }
+};
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <atomic>
+#include <stdint.h>
+#include "IMUSampler.h"
+#include "SpscQueue.h"
+
+// samples waiting for the serial transport - must be a power of two. About
+// 300 ms at the fastest rate.
+#define ALLAN_QUEUE_SIZE 256
+// output data rate used if ALLAN is sent without one - Hz
+#define ALLAN_DEFAULT_RATE 104
+
+// Long raw capture for noise characterisation (see tools/allan_deviation).
+// While it runs the sensor is held at a fixed output data rate with range
+// escalation off, and every sample - not just the latest one at the transport
+// rate - is queued for the serial transport to send as a STREAM_RAW line.
+class AllanCapture {
+private:
+  std::atomic<bool> running;
+  uint32_t droppedAtStart = 0;
+
+public:
+  SpscQueue<IMUSample, ALLAN_QUEUE_SIZE> samples;
+  // rate the capture runs at and the one to go back to afterwards - Hz
+  uint16_t sampleRate = 0;
+  uint16_t previousRate = 0;
+  uint32_t startMicros = 0;
+  // samples seen since start - only written by the IMU loop
+  volatile uint32_t recorded = 0;
+
+  AllanCapture() : running(false) {}
+
+  void start(uint16_t sampleRate, uint16_t previousRate, uint32_t nowMicros) {
+    this->sampleRate = sampleRate;
+    this->previousRate = previousRate;
+    startMicros = nowMicros;
+    recorded = 0;
+    droppedAtStart = samples.dropped.load();
+    running.store(true, std::memory_order_release);
+  }
+
+  void stop() {
+    running.store(false, std::memory_order_release);
+  }
+
+  bool isRunning() {
+    return running.load(std::memory_order_acquire);
+  }
+
+  // IMU loop - every sample, straight from the sampler
+  void record(const IMUSample &sample) {
+    if (!isRunning()) return;
+    samples.push(sample);
+    recorded++;
+  }
+
+  // samples the serial transport couldn't keep up with since start
+  uint32_t dropped() {
+    return samples.dropped.load() - droppedAtStart;
+  }
+};
@@ -0,0 +1,90 @@
+#pragma once
+
+// Mounting orientation correction. FusionAxesSwap does the same job but goes
+// through a 24-way switch on every call - here each alignment is turned into
+// a permutation/sign table once, so remapping a sample is three indexed
+// multiplies whatever the alignment.
+
+#include "Fusion.h"
+#include <atomic>
+#include <math.h>
+#include <stdint.h>
+#include <string>
+
+#define AXES_ALIGNMENT_COUNT 24
+
+class AxesRemap {
+private:
+  struct AxisMap {
+    uint8_t source[3];
+    float sign[3];
+  };
+
+  // one entry per FusionAxesAlignment, built by pushing a probe vector
+  // through FusionAxesSwap so we can't disagree with Fusion's definitions
+  struct AxisTable {
+    AxisMap maps[AXES_ALIGNMENT_COUNT];
+    AxisTable() {
+      const FusionVector probe = {.axis = {.x = 1.0f, .y = 2.0f, .z = 3.0f}};
+      for (int a = 0; a < AXES_ALIGNMENT_COUNT; a++) {
+        const FusionVector swapped = FusionAxesSwap(probe, (FusionAxesAlignment)a);
+        for (int i = 0; i < 3; i++) {
+          maps[a].source[i] = (uint8_t)(fabsf(swapped.array[i]) - 1.0f);
+          maps[a].sign[i] = swapped.array[i] < 0.0f ? -1.0f : 1.0f;
+        }
+      }
+    }
+  };
+
+  static const AxisMap *table() {
+    static const AxisTable axisTable;
+    return axisTable.maps;
+  }
+
+  // atomic so other tasks can read the alignment while the sampler uses it
+  std::atomic<const AxisMap *> current;
+  std::atomic<uint8_t> alignment;
+
+public:
+  AxesRemap(FusionAxesAlignment alignment = FusionAxesAlignmentPXPYPZ) {
+    set(alignment);
+  }
+
+  void set(FusionAxesAlignment alignment) {
+    this->alignment = (uint8_t)alignment;
+    current = &table()[alignment];
+  }
+
+  FusionAxesAlignment get() {
+    return (FusionAxesAlignment)alignment.load();
+  }
+
+  FusionVector apply(const FusionVector sensor) const {
+    const AxisMap *map = current.load(std::memory_order_relaxed);
+    FusionVector body;
+    body.axis.x = map->sign[0] * sensor.array[map->source[0]];
+    body.axis.y = map->sign[1] * sensor.array[map->source[1]];
+    body.axis.z = map->sign[2] * sensor.array[map->source[2]];
+    return body;
+  }
+
+  // names match the enum suffixes, e.g. "PXNZPY" is +X-Z+Y
+  static const char *name(FusionAxesAlignment alignment) {
+    static const char *const names[AXES_ALIGNMENT_COUNT] = {
+        "PXPYPZ", "PXNZPY", "PXNYNZ", "PXPZNY", "NXPYNZ", "NXPZPY",
+        "NXNYPZ", "NXNZNY", "PYNXPZ", "PYNZNX", "PYPXNZ", "PYPZPX",
+        "NYPXPZ", "NYNZPX", "NYNXNZ", "NYPZNX", "PZPYNX", "PZPXPY",
+        "PZNYPX", "PZNXNY", "NZPYPX", "NZNXPY", "NZNYNX", "NZPXNY"};
+    return (unsigned)alignment < AXES_ALIGNMENT_COUNT ? names[alignment] : "";
+  }
+
+  static bool parse(const std::string &text, FusionAxesAlignment &alignment) {
+    for (int a = 0; a < AXES_ALIGNMENT_COUNT; a++) {
+      if (text == name((FusionAxesAlignment)a)) {
+        alignment = (FusionAxesAlignment)a;
+        return true;
+      }
+    }
+    return false;
+  }
+};
@@ -0,0 +1,135 @@
+#pragma once
+
+#include <Arduino.h>
+#include <freertos/FreeRTOS.h>
+#include <atomic>
+#include <sstream>
+#include "CommandProcessor.h"
+#include "IMUFusion.h"
+#include "AxesRemap.h"
+#include "SerialTransport.h"
+#include "BluetoothTransport.h"
+
+#define BENCH_DEFAULT_ITERATIONS 1000
+// calls per timed batch - short enough that most batches aren't interrupted
+#define BENCH_BATCH 8
+
+// On-target micro benchmarks for the BENCH command. Each routine is run on
+// synthetic data in batches of BENCH_BATCH calls, each timed with the CPU
+// cycle counter, and the fastest batch is reported - so the numbers are
+// cycles per call on the actual device without the time the benchmark spent
+// preempted. It runs in its own task pinned to the IMU loop's core at idle
+// priority, so fusion keeps up while it runs and the per-core cycle counter
+// is always read on the same core. The results are sent as a command reply (so
+// they're printed by the transport task, not this one) in a single JSON line:
+//   {"bench":{"iterations":1000,"cpuMHz":240,"cycles":{"FusionOffsetUpdate":123.4,...}}}
+class Bench {
+private:
+  // keeps the optimiser from discarding the work being measured
+  static inline volatile float sink = 0.0f;
+  static inline std::atomic<bool> running{false};
+  // where the result goes - set by start() while nothing is running
+  static inline CommandProcessor *commands = nullptr;
+
+  // synthetic gyro (deg/s) and accelerometer (g) that vary per iteration
+  static FusionVector syntheticGyro(int i) {
+    const FusionVector v = {.axis = {.x = 10.0f + (i & 15), .y = -5.0f + (i & 7), .z = 2.0f}};
+    return v;
+  }
+  static FusionVector syntheticAccel(int i) {
+    const FusionVector v = {.axis = {.x = 0.01f * (i & 3), .y = 0.02f, .z = 0.98f}};
+    return v;
+  }
+
+  // a batch takes microseconds, so the 32 bit counter wraps at most once
+  // and the unsigned difference is still right
+  template <typename F>
+  static float cyclesPerCall(int iterations, F body) {
+    uint32_t fastest = UINT32_MAX;
+    for (int i = 0; i < iterations; i += BENCH_BATCH) {
+      const uint32_t start = ESP.getCycleCount();
+      for (int j = i; j < i + BENCH_BATCH; j++) {
+        body(j);
+      }
+      const uint32_t cycles = ESP.getCycleCount() - start;
+      if (cycles < fastest) fastest = cycles;
+    }
+    return (float)fastest / BENCH_BATCH;
+  }
+
+  static void task(void *pvParameter) {
+    run((int)(intptr_t)pvParameter);
+    running = false;
+    vTaskDelete(nullptr);
+  }
+
+  static void run(int iterations) {
+    std::stringstream ss;
+    ss << "{\"bench\":{\"iterations\":" << iterations;
+    ss << ",\"cpuMHz\":" << ESP.getCpuFreqMHz() << ",\"cycles\":{";
+
+    IMUFusion fusion;
+    FusionAhrs &ahrs = fusion.g_ahrs;
+    ss << "\"FusionAhrsUpdateNoMagnetometer\":" << cyclesPerCall(iterations, [&](int i) {
+      FusionAhrsUpdateNoMagnetometer(&ahrs, syntheticGyro(i), syntheticAccel(i), 0.005f);
+    });
+    sink = ahrs.quaternion.element.w;
+
+    FusionOffset offset;
+    FusionOffsetInitialise(&offset, IMU_FUSION_SAMPLE_RATE);
+    ss << ",\"FusionOffsetUpdate\":" << cyclesPerCall(iterations, [&](int i) {
+      sink = FusionOffsetUpdate(&offset, syntheticGyro(i)).axis.x;
+    });
+
+    const FusionQuaternion q = FusionAhrsGetQuaternion(&ahrs);
+    ss << ",\"FusionQuaternionToEuler\":" << cyclesPerCall(iterations, [&](int i) {
+      FusionQuaternion qi = q;
+      qi.element.x += i * 1e-6f;
+      sink = FusionQuaternionToEuler(qi).angle.yaw;
+    });
+
+    AxesRemap axes(FusionAxesAlignmentNYPZNX);
+    ss << ",\"AxesRemap::apply\":" << cyclesPerCall(iterations, [&](int i) {
+      sink = axes.apply(syntheticGyro(i)).axis.z;
+    });
+    ss << ",\"FusionAxesSwap\":" << cyclesPerCall(iterations, [&](int i) {
+      sink = FusionAxesSwap(syntheticGyro(i), FusionAxesAlignmentNYPZNX).axis.z;
+    });
+
+    ss << ",\"updateGyroIntegration\":" << cyclesPerCall(iterations, [&](int i) {
+      fusion.updateGyroIntegration(syntheticGyro(i), 0.005f);
+    });
+    sink = fusion.accumulatedGyroZ;
+
+    ss << ",\"IMUFusion::process\":" << cyclesPerCall(iterations, [&](int i) {
+      fusion.process(syntheticGyro(i), syntheticAccel(i), 25.0f, i * 5000u);
+    });
+
+    const IMUData data = fusion.getData();
+    ss << ",\"SerialTransport::encodeJson\":" << cyclesPerCall(iterations, [&](int) {
+      sink = SerialTransport::encodeJson(data).size();
+    });
+    ss << ",\"SerialTransport::encodeRaw\":" << cyclesPerCall(iterations, [&](int) {
+      sink = SerialTransport::encodeRaw(data).size();
+    });
+    ss << ",\"BluetoothTransport::encodePacket\":" << cyclesPerCall(iterations, [&](int) {
+      float packet[BLE_PACKET_LENGTH];
+      BluetoothTransport::encodePacket(data, packet);
+      sink = packet[13];
+    });
+
+    ss << "}}}";
+    commands->reply(ss.str());
+  }
+
+public:
+  // runs the benchmarks in the background and replies with the results -
+  // false if they're already running
+  static bool start(CommandProcessor *commands, int iterations = BENCH_DEFAULT_ITERATIONS) {
+    if (iterations <= 0) iterations = BENCH_DEFAULT_ITERATIONS;
+    if (running.exchange(true)) return false;
+    Bench::commands = commands;
+    xTaskCreatePinnedToCore(task, "Bench", 8192, (void *)(intptr_t)iterations, tskIDLE_PRIORITY, nullptr, 1);
+    return true;
+  }
+};
@@ -8,15 +8,100 @@
 #define BLE_SERVICE_UUID "9c2a8b2a-6c7a-4b8b-bf3c-7f6b1f7f0001"
 #define BLE_PACKET_UUID "9c2a8b2a-6c7a-4b8b-bf3c-7f6b1f7f2001" // combined packet
 #define BLE_CONTROL_UUID "9c2a8b2a-6c7a-4b8b-bf3c-7f6b1f7f1001" // control write (commands)
+#define BLE_DIAGNOSTICS_UUID "9c2a8b2a-6c7a-4b8b-bf3c-7f6b1f7f3001" // diagnostics packet
+#define BLE_EVENT_UUID "9c2a8b2a-6c7a-4b8b-bf3c-7f6b1f7f4001" // event packet
+#define BLE_BURST_UUID "9c2a8b2a-6c7a-4b8b-bf3c-7f6b1f7f5001" // burst capture chunks
+
+// floats in the combined packet
+#define BLE_PACKET_LENGTH 18
+// most samples in one burst notification, and how many times a notification
+// is retried (1 ms apart) while the stack is out of buffers
+#define BLE_BURST_SAMPLES_PER_CHUNK 5
+#define BLE_BURST_NOTIFY_RETRIES 20
+
+// Header of each burst notification - every chunk carries it so a client can
+// join part way through. Followed by up to BLE_BURST_SAMPLES_PER_CHUNK samples.
+struct __attribute__((packed)) BleBurstHeader {
+  // trigger rule
+  uint8_t id;
+  uint8_t reserved;
+  // index of this notification's first sample
+  uint16_t first;
+  uint16_t samples;
+  uint16_t pre;
+  uint32_t triggerMicros;
+};
+
+// one burst sample - the STREAM_RAW values
+struct __attribute__((packed)) BleBurstSample {
+  uint32_t timeMicros;
+  float gx, gy, gz;
+  float ax, ay, az;
+  float temp;
+};
 
 class BluetoothTransport : public Transport, NimBLECharacteristicCallbacks {
 private:
   NimBLEServer *bleServer = nullptr;
   NimBLECharacteristic *blePacketCharacteristic;
   NimBLECharacteristic *bleControlCharacteristic;
+  NimBLECharacteristic *bleDiagnosticsCharacteristic = nullptr;
+  NimBLECharacteristic *bleEventCharacteristic = nullptr;
+  NimBLECharacteristic *bleBurstCharacteristic = nullptr;
+
+  // notify, waiting for the stack to free a buffer if it has to
+  static bool notifyWithRetry(NimBLECharacteristic *characteristic) {
+    for (int attempt = 0; attempt < BLE_BURST_NOTIFY_RETRIES; attempt++) {
+      if (characteristic->notify()) return true;
+      vTaskDelay(1);
+    }
+    return false;
+  }
 
 public:
-  BluetoothTransport(Transport::ResetGyroHandler onResetGyro): Transport("BluetoothTransport", onResetGyro) {
+  BluetoothTransport(CommandProcessor *commands): Transport("BluetoothTransport", commands) {
+  }
+
+  // packs the notify payload - see the README for the layout
+  static void encodePacket(const IMUData &data, float packet[BLE_PACKET_LENGTH]) {
+    packet[0] = data.ax;
+    packet[1] = data.ay;
+    packet[2] = data.az;
+    packet[3] = data.gx;
+    packet[4] = data.gy;
+    packet[5] = data.gz;
+    packet[6] = data.accumulatedGyroX;
+    packet[7] = data.accumulatedGyroY;
+    packet[8] = data.accumulatedGyroZ;
+    packet[9] = data.fusionRoll;
+    packet[10] = data.fusionPitch;
+    packet[11] = data.fusionYaw;
+    packet[12] = data.temperatureC;
+    packet[13] = data.timeSec;
+    packet[14] = data.predictedRoll;
+    packet[15] = data.predictedPitch;
+    packet[16] = data.predictedYaw;
+    packet[17] = data.predictionMs;
+  }
+
+  // packs the diagnostics notify payload - see the README for the layout
+  static void encodeDiagnosticsPacket(const IMUDiagnostics &diagnostics, float packet[16]) {
+    packet[0] = diagnostics.accelerationError;
+    packet[1] = diagnostics.accelerometerIgnored ? 1.0f : 0.0f;
+    packet[2] = diagnostics.accelerationRecoveryTrigger;
+    packet[3] = diagnostics.initialising ? 1.0f : 0.0f;
+    packet[4] = diagnostics.angularRateRecovery ? 1.0f : 0.0f;
+    packet[5] = diagnostics.accelerationRecovery ? 1.0f : 0.0f;
+    packet[6] = diagnostics.gyroBiasX;
+    packet[7] = diagnostics.gyroBiasY;
+    packet[8] = diagnostics.gyroBiasZ;
+    packet[9] = diagnostics.offsetTimer;
+    packet[10] = diagnostics.offsetState;
+    packet[11] = diagnostics.offsetCutoff;
+    packet[12] = diagnostics.driftAngle;
+    packet[13] = diagnostics.driftRate;
+    packet[14] = diagnostics.driftAverageRate;
+    packet[15] = diagnostics.timeMicros / 1e6f;
   }
 
   void begin() override {
@@ -44,6 +129,18 @@ public:
         NIMBLE_PROPERTY::WRITE | NIMBLE_PROPERTY::WRITE_NR);
     bleControlCharacteristic->setCallbacks(this);
 
+    // Low rate AHRS diagnostics - only sent when enabled with the DIAGNOSTICS command
+    bleDiagnosticsCharacteristic = service->createCharacteristic(
+        BLE_DIAGNOSTICS_UUID, NIMBLE_PROPERTY::READ | NIMBLE_PROPERTY::NOTIFY);
+
+    // Events - clients that only care about these can skip the packet stream
+    bleEventCharacteristic = service->createCharacteristic(
+        BLE_EVENT_UUID, NIMBLE_PROPERTY::READ | NIMBLE_PROPERTY::NOTIFY);
+
+    // Burst captures from BURST triggers, in chunks sized to fit the MTU
+    bleBurstCharacteristic = service->createCharacteristic(
+        BLE_BURST_UUID, NIMBLE_PROPERTY::READ | NIMBLE_PROPERTY::NOTIFY);
+
     service->start();
 
     NimBLEAdvertising *advertising = NimBLEDevice::getAdvertising();
@@ -59,20 +156,8 @@ public:
     return bleServer && bleServer->getConnectedCount() > 0;
   }
   void transmit() override {
-    float packet[14] = {data.ax,
-                        data.ay,
-                        data.az,
-                        data.gx,
-                        data.gy,
-                        data.gz,
-                        data.accumulatedGyroX,
-                        data.accumulatedGyroY,
-                        data.accumulatedGyroZ,
-                        data.fusionRoll,
-                        data.fusionPitch,
-                        data.fusionYaw,
-                        data.temperatureC,
-                        data.timeSec};
+    float packet[BLE_PACKET_LENGTH];
+    encodePacket(data, packet);
     if (blePacketCharacteristic) {
       blePacketCharacteristic->setValue(
           reinterpret_cast<const uint8_t *>(packet), sizeof(packet));
@@ -80,6 +165,59 @@ public:
     }
   }
 
+  void transmitDiagnostics(const IMUDiagnostics &diagnostics) override {
+    float packet[16];
+    encodeDiagnosticsPacket(diagnostics, packet);
+    if (bleDiagnosticsCharacteristic) {
+      bleDiagnosticsCharacteristic->setValue(
+          reinterpret_cast<const uint8_t *>(packet), sizeof(packet));
+      bleDiagnosticsCharacteristic->notify();
+    }
+  }
+
+  void transmitEvent(const IMUEvent &event) override {
+    if (bleEventCharacteristic) {
+      bleEventCharacteristic->setValue(
+          reinterpret_cast<const uint8_t *>(&event), sizeof(event));
+      bleEventCharacteristic->notify();
+    }
+  }
+
+  // Sent as a run of notifications, each a BleBurstHeader and as many
+  // BleBurstSamples as the negotiated MTU allows. Blocks the scheduler while
+  // the stack drains, about as long as the serial version takes.
+  bool transmitBurst(BurstCapture &burst) override {
+    if (!bleBurstCharacteristic || !isConnected()) return false;
+    // ATT notifications carry MTU - 3 bytes
+    const size_t payload = bleServer->getPeerInfo(0).getMTU() - 3;
+    if (payload < sizeof(BleBurstHeader) + sizeof(BleBurstSample)) return false;
+    size_t perChunk = (payload - sizeof(BleBurstHeader)) / sizeof(BleBurstSample);
+    if (perChunk > BLE_BURST_SAMPLES_PER_CHUNK) perChunk = BLE_BURST_SAMPLES_PER_CHUNK;
+
+    uint8_t chunk[sizeof(BleBurstHeader) + BLE_BURST_SAMPLES_PER_CHUNK * sizeof(BleBurstSample)];
+    BleBurstHeader header;
+    header.id = burst.id;
+    header.reserved = 0;
+    header.samples = (uint16_t)burst.count();
+    header.pre = (uint16_t)burst.preTriggerCount();
+    header.triggerMicros = burst.triggerMicros;
+    for (size_t first = 0; first < burst.count(); first += perChunk) {
+      header.first = (uint16_t)first;
+      memcpy(chunk, &header, sizeof(header));
+      size_t length = sizeof(header);
+      for (size_t i = first; i < first + perChunk && i < burst.count(); i++) {
+        const IMUData &data = burst.sample(i);
+        const BleBurstSample sample = {data.timeMicros, data.rawGx, data.rawGy, data.rawGz,
+                                       data.ax, data.ay, data.az, data.temperatureC};
+        memcpy(chunk + length, &sample, sizeof(sample));
+        length += sizeof(sample);
+      }
+      bleBurstCharacteristic->setValue(chunk, length);
+      if (!notifyWithRetry(bleBurstCharacteristic)) return false;
+    }
+    return true;
+  }
+
   void onWrite (NimBLECharacteristic *pCharacteristic, NimBLEConnInfo &connInfo) override {
     std::string value = pCharacteristic->getValue();
     // Accept ASCII commands, case-insensitive, trim whitespace
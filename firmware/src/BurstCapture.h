@@ -0,0 +1,89 @@
+#pragma once
+
+#include <atomic>
+#include <stdint.h>
+#include "IMUFusion.h"
+
+// samples kept from before the trigger and recorded after it
+#define BURST_PRE_SAMPLES 64
+#define BURST_POST_SAMPLES 192
+#define BURST_CAPACITY (BURST_PRE_SAMPLES + BURST_POST_SAMPLES)
+
+// Full-rate capture around a trigger. The IMU loop records every sample into
+// a ring so there's always some history; a trigger records a fixed number of
+// samples after it and then hands the whole buffer to the transport task,
+// which sends it and releases it for the next burst.
+class BurstCapture {
+public:
+  enum State : uint8_t {
+    // filling the pre-trigger ring
+    BURST_RECORDING,
+    // triggered - recording the samples after it
+    BURST_TRIGGERED,
+    // complete and waiting to be sent - the IMU loop leaves it alone
+    BURST_READY,
+  };
+
+private:
+  IMUData samples[BURST_CAPACITY];
+  // total samples written since the last release
+  uint32_t written = 0;
+  uint32_t remaining = 0;
+  uint32_t preSamples = 0;
+  std::atomic<uint8_t> state;
+
+public:
+  // which trigger fired and when - microseconds
+  uint8_t id = 0;
+  uint32_t triggerMicros = 0;
+
+  BurstCapture() : state(BURST_RECORDING) {}
+
+  // IMU loop - every sample
+  void record(const IMUData &data) {
+    const uint8_t current = state.load(std::memory_order_acquire);
+    if (current == BURST_READY) return;
+    samples[written % BURST_CAPACITY] = data;
+    written++;
+    if (current == BURST_TRIGGERED && --remaining == 0) {
+      state.store(BURST_READY, std::memory_order_release);
+    }
+  }
+
+  // IMU loop - returns false if a burst is already in progress
+  bool trigger(uint8_t id, uint32_t nowMicros) {
+    if (state.load(std::memory_order_acquire) != BURST_RECORDING) return false;
+    this->id = id;
+    triggerMicros = nowMicros;
+    preSamples = written < BURST_PRE_SAMPLES ? written : BURST_PRE_SAMPLES;
+    // keep only the last BURST_PRE_SAMPLES of history
+    remaining = BURST_CAPACITY - preSamples;
+    state.store(BURST_TRIGGERED, std::memory_order_release);
+    return true;
+  }
+
+  // transport task - only read the samples once this is true
+  bool ready() {
+    return state.load(std::memory_order_acquire) == BURST_READY;
+  }
+
+  size_t count() {
+    return written < BURST_CAPACITY ? written : BURST_CAPACITY;
+  }
+
+  size_t preTriggerCount() {
+    return preSamples;
+  }
+
+  // i-th sample in time order
+  const IMUData &sample(size_t i) {
+    const uint32_t oldest = written < BURST_CAPACITY ? 0 : written - BURST_CAPACITY;
+    return samples[(oldest + i) % BURST_CAPACITY];
+  }
+
+  // transport task - done with the samples, start recording again
+  void release() {
+    written = 0;
+    state.store(BURST_RECORDING, std::memory_order_release);
+  }
+};
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <freertos/FreeRTOS.h>
+#include <functional>
+#include <map>
+#include <string.h>
+#include <string>
+
+// longest command line and how many can wait to be run
+#define COMMAND_MAX_LENGTH 128
+#define COMMAND_QUEUE_LENGTH 8
+
+// Dispatches ASCII commands received by any transport. A command line is a
+// name optionally followed by a space and arguments, e.g. "BENCH 2000".
+// Handlers touch the fusion state, so transports post() commands from
+// whatever task they arrive on and the IMU loop runs them with runPending()
+// between samples. Handlers answer with reply() rather than printing, so the
+// transport task stays the only thing writing to serial.
+class CommandProcessor {
+public:
+  using CommandHandler = std::function<void(const std::string &args)>;
+  using ReplyHandler = std::function<void(const std::string &line)>;
+
+private:
+  struct Pending {
+    char text[COMMAND_MAX_LENGTH + 1];
+  };
+
+  std::map<std::string, CommandHandler> handlers;
+  QueueHandle_t queue = nullptr;
+  // woken when a command is posted
+  TaskHandle_t consumer = nullptr;
+  // where reply() lines go - see TransportManager::reply
+  ReplyHandler replyHandler;
+
+public:
+  // consumer is the task that calls runPending()
+  void begin(TaskHandle_t consumer) {
+    queue = xQueueCreate(COMMAND_QUEUE_LENGTH, sizeof(Pending));
+    this->consumer = consumer;
+  }
+
+  void setReplyHandler(ReplyHandler handler) {
+    replyHandler = handler;
+  }
+
+  // any task - one line of output for the user, dropped if nothing is set up
+  // to send it yet
+  void reply(const std::string &line) {
+    if (replyHandler) replyHandler(line);
+  }
+
+  void registerCommand(const std::string &name, CommandHandler handler) {
+    handlers[name] = handler;
+  }
+
+  // any task - never blocks, drops the command if it's too long or we're
+  // backed up
+  bool post(const std::string &cmd) {
+    if (!queue || cmd.size() > COMMAND_MAX_LENGTH) return false;
+    Pending pending;
+    memcpy(pending.text, cmd.c_str(), cmd.size() + 1);
+    if (xQueueSend(queue, &pending, 0) != pdTRUE) return false;
+    if (consumer) xTaskNotifyGive(consumer);
+    return true;
+  }
+
+  // consumer task - runs everything that's been posted
+  void runPending() {
+    if (!queue) return;
+    Pending pending;
+    while (xQueueReceive(queue, &pending, 0) == pdTRUE) {
+      process(pending.text);
+    }
+  }
+
+  // cmd should already be trimmed and upper-cased by the transport
+  bool process(const std::string &cmd) {
+    const size_t space = cmd.find(' ');
+    const std::string name = cmd.substr(0, space);
+    const std::string args = space == std::string::npos ? "" : cmd.substr(space + 1);
+    auto it = handlers.find(name);
+    if (it == handlers.end()) return false;
+    it->second(args);
+    return true;
+  }
+};
@@ -0,0 +1,74 @@
+#pragma once
+
+// Tracks how far the pure gyro orientation wanders away from the AHRS
+// orientation. Both integrate the same offset-corrected gyro, so any growth
+// in the angle between them is gyro error the AHRS is correcting with the
+// accelerometer - a unit whose drift rate climbs has a degrading sensor or a
+// bad bias estimate.
+
+#include "Fusion.h"
+#include <math.h>
+#include <stdint.h>
+
+// how often the drift rate is measured and how much each measurement counts
+#define DRIFT_RATE_WINDOW_MICROS 1000000
+#define DRIFT_RATE_SMOOTHING 0.2f
+
+class DriftMonitor {
+private:
+  // conjugate of the fused to gyro rotation when we started measuring
+  FusionQuaternion reference;
+  bool hasReference = false;
+  uint32_t referenceMicros = 0;
+  uint32_t windowMicros = 0;
+  float windowAngle = 0.0f;
+
+  static FusionQuaternion conjugate(const FusionQuaternion q) {
+    const FusionQuaternion result = {.element = {.w = q.element.w, .x = -q.element.x, .y = -q.element.y, .z = -q.element.z}};
+    return result;
+  }
+
+public:
+  // angle between the two orientations since the reference - deg
+  float angle = 0.0f;
+  // smoothed recent drift rate - deg/min
+  float rate = 0.0f;
+  // average drift rate since the reference - deg/min
+  float averageRate = 0.0f;
+
+  // the next update becomes the new reference
+  void reset() {
+    hasReference = false;
+    angle = 0.0f;
+    rate = 0.0f;
+    averageRate = 0.0f;
+  }
+
+  void update(const FusionQuaternion fused, const FusionQuaternion gyro, const uint32_t nowMicros) {
+    // rotation from the fused to the gyro orientation - the starting value is
+    // whatever alignment they had at the reference so we measure change from it
+    const FusionQuaternion difference = FusionQuaternionMultiply(conjugate(fused), gyro);
+    if (!hasReference) {
+      reference = conjugate(difference);
+      hasReference = true;
+      referenceMicros = nowMicros;
+      windowMicros = nowMicros;
+      windowAngle = 0.0f;
+      return;
+    }
+    const FusionQuaternion drift = FusionQuaternionMultiply(reference, difference);
+    // atan2 rather than acos(w) keeps precision for small angles
+    const float vectorNorm = sqrtf(drift.element.x * drift.element.x + drift.element.y * drift.element.y +
+                                   drift.element.z * drift.element.z);
+    angle = FusionRadiansToDegrees(2.0f * atan2f(vectorNorm, fabsf(drift.element.w)));
+
+    const uint32_t windowElapsed = nowMicros - windowMicros;
+    if (windowElapsed >= DRIFT_RATE_WINDOW_MICROS) {
+      const float windowRate = (angle - windowAngle) * 60e6f / windowElapsed;
+      rate += DRIFT_RATE_SMOOTHING * (windowRate - rate);
+      averageRate = angle * 60e6f / (nowMicros - referenceMicros);
+      windowMicros = nowMicros;
+      windowAngle = angle;
+    }
+  }
+};
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <stdint.h>
+
+enum IMUEventType : uint8_t {
+  // the device stopped / started moving - value is how long (s) it was in
+  // the previous state
+  EVENT_STATIONARY = 1,
+  EVENT_MOVING = 2,
+  // a TriggerEngine rule fired - id is the rule, value is the channel value
+  // (or rate of change for RATE rules)
+  EVENT_TRIGGER = 3,
+  // rising edge on the sync input (id 0) or one we drove on the sync output
+  // (id 1) - value is the edge count
+  EVENT_SYNC = 4,
+};
+
+// Compact event sent alongside (or instead of) the sample stream. This is
+// also the BLE event packet layout, little-endian, 12 bytes.
+struct __attribute__((packed)) IMUEvent {
+  uint8_t type;
+  // which rule/input raised it, where there's more than one
+  uint8_t id;
+  uint16_t reserved;
+  // sample time - microseconds
+  uint32_t timeMicros;
+  float value;
+
+  static IMUEvent make(IMUEventType type, uint8_t id, uint32_t timeMicros, float value) {
+    IMUEvent event;
+    event.type = type;
+    event.id = id;
+    event.reserved = 0;
+    event.timeMicros = timeMicros;
+    event.value = value;
+    return event;
+  }
+
+  static const char *typeName(uint8_t type) {
+    switch (type) {
+    case EVENT_STATIONARY:
+      return "STATIONARY";
+    case EVENT_MOVING:
+      return "MOVING";
+    case EVENT_TRIGGER:
+      return "TRIGGER";
+    case EVENT_SYNC:
+      return "SYNC";
+    default:
+      return "UNKNOWN";
+    }
+  }
+};
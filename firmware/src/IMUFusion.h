@@ -0,0 +1,305 @@
+#pragma once
+
+// Sensor-independent half of the IMU pipeline (offset correction, AHRS and
+// pure gyro integration). This header has no Arduino dependencies so the host
+// tools in /tools can replay captures through exactly the same code.
+
+#include "Fusion.h"
+#include "AdaptiveOffset.h"
+#include "DriftMonitor.h"
+#include "MotionClassifier.h"
+#include "OrientationPredictor.h"
+#include <math.h>
+#include <stdint.h>
+
+// fallback sample rate (Hz) for code that doesn't know the real one - the
+// device passes its output data rate to defaultSettings() and IMUFusion, and
+// the host tools use the rate measured from the capture (captureSampleRate)
+#define IMU_FUSION_SAMPLE_RATE 200
+// how long the AHRS ignores the accelerometer before forcing a recovery - s
+#define IMU_FUSION_RECOVERY_SECONDS 5
+
+struct IMUData {
+  // accelerometer data - g
+  float ax;
+  float ay;
+  float az;
+  // gyro data - deg/s
+  float gx;
+  float gy;
+  float gz;
+  // accumulated gyro data - deg
+  float accumulatedGyroX;
+  float accumulatedGyroY;
+  float accumulatedGyroZ;
+  // fusion data - deg
+  float fusionRoll;
+  float fusionPitch;
+  float fusionYaw;
+  // temperature - C
+  float temperatureC;
+  // time - seconds
+  float timeSec;
+  // raw gyro data before offset correction - deg/s
+  float rawGx;
+  float rawGy;
+  float rawGz;
+  // fusion orientation extrapolated predictionMs ahead - deg. Same as the
+  // fusion angles when prediction is off
+  float predictedRoll;
+  float predictedPitch;
+  float predictedYaw;
+  float predictionMs;
+  // time - microseconds (wraps after ~71 minutes)
+  uint32_t timeMicros;
+};
+
+// AHRS and gyro offset algorithm state for the diagnostics channel
+struct IMUDiagnostics {
+  // AHRS internal states - error in deg, recovery trigger 0 to 1
+  float accelerationError;
+  bool accelerometerIgnored;
+  float accelerationRecoveryTrigger;
+  // AHRS flags
+  bool initialising;
+  bool angularRateRecovery;
+  bool accelerationRecovery;
+  // FusionOffset bias estimate - deg/s
+  float gyroBiasX;
+  float gyroBiasY;
+  float gyroBiasZ;
+  // samples the gyro has been stationary for
+  unsigned int offsetTimer;
+  // how far the adaptive offset has got and its current cutoff - Hz
+  OffsetConvergence offsetState;
+  float offsetCutoff;
+  // angle between the fused and pure gyro orientations - deg, and how fast
+  // it's growing recently and on average - deg/min
+  float driftAngle;
+  float driftRate;
+  float driftAverageRate;
+  // time - microseconds
+  uint32_t timeMicros;
+};
+
+class IMUFusion {
+private:
+  static float wrapAngle(float angle) {
+    while (angle < -180.0f)
+      angle += 360.0f;
+    while (angle > 180.0f)
+      angle -= 360.0f;
+    return angle;
+  }
+
+public:
+  FusionAhrs g_ahrs;
+  FusionAhrsSettings settings;
+  FusionEuler fusionEuler;
+  OrientationPredictor predictor;
+  FusionEuler predictedEuler;
+  AdaptiveOffset offset;
+  DriftMonitor drift;
+  MotionClassifier motion;
+  // set when the last sample changed motion.moving
+  bool motionChanged = false;
+  FusionQuaternion gyroQuaternion;
+  FusionVector rawGyroscope;
+  FusionVector gyroscopeDegPerSec;
+  FusionVector accelerometer;
+  float temperatureC = 0.0f;
+  float accumulatedGyroX = 0.0f;
+  float accumulatedGyroY = 0.0f;
+  float accumulatedGyroZ = 0.0f;
+  uint32_t lastUpdateMicros = 0;
+  // rate the offset and recovery period are set up for - Hz
+  unsigned int sampleRate;
+
+  // The settings used on the device - hand-picked, see tools/fusion_sweep and
+  // tools/fusion_tune for ways of choosing better ones from recorded captures.
+  // The recovery period is counted in samples, so it's scaled to keep it
+  // IMU_FUSION_RECOVERY_SECONDS at any update rate (Hz).
+  static FusionAhrsSettings defaultSettings(unsigned int sampleRate = IMU_FUSION_SAMPLE_RATE) {
+    const FusionAhrsSettings settings = {
+        .convention = FusionConventionNwu,
+        .gain = 0.5f,
+        .gyroscopeRange = 2000.0f,      // deg/s (set to your gyro full-scale)
+        .accelerationRejection = 10.0f, // degrees
+        .magneticRejection = 0.0f,      // no magnetometer in use
+        .recoveryTriggerPeriod = (unsigned int)(IMU_FUSION_RECOVERY_SECONDS * sampleRate) // samples
+    };
+    return settings;
+  }
+
+  IMUFusion(const FusionAhrsSettings &settings = defaultSettings(),
+            unsigned int sampleRate = IMU_FUSION_SAMPLE_RATE)
+      : offset(sampleRate), sampleRate(sampleRate) {
+    // Initialise Fusion AHRS
+    this->settings = settings;
+    FusionAhrsInitialise(&g_ahrs);
+    FusionAhrsSetSettings(&g_ahrs, &settings);
+
+    fusionEuler = FUSION_EULER_ZERO;
+    predictedEuler = FUSION_EULER_ZERO;
+    rawGyroscope = FUSION_VECTOR_ZERO;
+    gyroscopeDegPerSec = FUSION_VECTOR_ZERO;
+    accelerometer = FUSION_VECTOR_ZERO;
+
+    // Reset pure gyro integrator orientation to identity
+    gyroQuaternion = FUSION_IDENTITY_QUATERNION;
+  }
+
+  // Integrate gyroscope (deg/s) over deltaTime (s) into persistent quaternion
+  // and output Euler angles (deg)
+  void updateGyroIntegration(const FusionVector gyroscopeDegPerSec,
+                                    const float deltaTime) {
+    // Convert deg/s to rad/s
+    const float wx = FusionDegreesToRadians(gyroscopeDegPerSec.axis.x);
+    const float wy = FusionDegreesToRadians(gyroscopeDegPerSec.axis.y);
+    const float wz = FusionDegreesToRadians(gyroscopeDegPerSec.axis.z);
+    const float omegaMag = sqrtf(wx * wx + wy * wy + wz * wz);
+    if (omegaMag > 0.0f && deltaTime > 0.0f) {
+      const float angle = omegaMag * deltaTime; // radians
+      const float halfAngle = 0.5f * angle;
+      const float s = sinf(halfAngle) / omegaMag; // safe because omegaMag>0
+      const float c = cosf(halfAngle);
+      const FusionQuaternion delta = {.element = {
+                                          .w = c,
+                                          .x = wx * s,
+                                          .y = wy * s,
+                                          .z = wz * s,
+                                      }};
+      // q = q * delta
+      gyroQuaternion = FusionQuaternionMultiply(gyroQuaternion, delta);
+      gyroQuaternion = FusionQuaternionNormalise(gyroQuaternion);
+    }
+
+    const FusionEuler gyroEuler = FusionQuaternionToEuler(gyroQuaternion);
+    accumulatedGyroX = wrapAngle(gyroEuler.angle.roll);
+    accumulatedGyroY = wrapAngle(gyroEuler.angle.pitch);
+    accumulatedGyroZ = wrapAngle(gyroEuler.angle.yaw);
+  }
+
+  // keep the AHRS's gyro overflow detection in step with the sensor's
+  // full-scale range (deg/s) when it changes
+  void setGyroscopeRange(float range) {
+    settings.gyroscopeRange = range;
+    FusionAhrsSetSettings(&g_ahrs, &settings);
+  }
+
+  // the samples now come at another rate (Hz) - scale everything that's
+  // counted in samples so it lasts as long as before
+  void setSampleRate(unsigned int sampleRate) {
+    if (sampleRate == this->sampleRate || sampleRate == 0) return;
+    settings.recoveryTriggerPeriod = (unsigned int)((uint64_t)settings.recoveryTriggerPeriod * sampleRate / this->sampleRate);
+    FusionAhrsSetSettings(&g_ahrs, &settings);
+    offset.setSampleRate(sampleRate);
+    this->sampleRate = sampleRate;
+  }
+
+  void resetGyroIntegration() {
+    gyroQuaternion = FUSION_IDENTITY_QUATERNION;
+    drift.reset();
+    accumulatedGyroX = 0.0f;
+    accumulatedGyroY = 0.0f;
+    accumulatedGyroZ = 0.0f;
+  }
+
+  // the body frame changed (a new mounting orientation) - the AHRS, the gyro
+  // bias and the pure-gyro orientation all start again
+  void resetOrientation() {
+    FusionAhrsReset(&g_ahrs);
+    offset.reset();
+    resetGyroIntegration();
+  }
+
+  // Run one sample through the pipeline. gyroscope is the uncorrected sensor
+  // reading in deg/s, accelerometer is in g and nowMicros is the sample time.
+  void process(const FusionVector gyroscope, const FusionVector accelerometer,
+               const float temperatureC, const uint32_t nowMicros) {
+    this->rawGyroscope = gyroscope;
+    this->accelerometer = accelerometer;
+    this->temperatureC = temperatureC;
+
+    // Delta time for AHRS update (seconds)
+    float deltaTime = (nowMicros - lastUpdateMicros) / 1e6f;
+    lastUpdateMicros = nowMicros;
+    if (deltaTime <= 0.0f || deltaTime > 0.1f) {
+      // Guard against unreasonable dt (e.g., on startup or USB stall)
+      deltaTime = 0.01f;
+    }
+
+    // Update gyroscope offset correction algorithm
+    gyroscopeDegPerSec = offset.update(gyroscope);
+
+    // update the AHRS
+    FusionAhrsUpdateNoMagnetometer(&g_ahrs, gyroscopeDegPerSec, accelerometer,
+                                   deltaTime);
+
+    // Convert the quaternion to euler angles
+    fusionEuler =
+        FusionQuaternionToEuler(FusionAhrsGetQuaternion(&g_ahrs));
+    predictedEuler = FusionQuaternionToEuler(
+        predictor.update(FusionAhrsGetQuaternion(&g_ahrs), gyroscopeDegPerSec));
+
+    updateGyroIntegration(gyroscopeDegPerSec, deltaTime);
+
+    motionChanged = motion.update(gyroscopeDegPerSec, accelerometer, nowMicros);
+
+    // wait for the AHRS to settle before comparing against it
+    if (!FusionAhrsGetFlags(&g_ahrs).initialising) {
+      drift.update(FusionAhrsGetQuaternion(&g_ahrs), gyroQuaternion, nowMicros);
+    }
+  }
+
+  IMUData getData() {
+    IMUData data;
+    data.ax = accelerometer.axis.x;
+    data.ay = accelerometer.axis.y;
+    data.az = accelerometer.axis.z;
+    data.gx = gyroscopeDegPerSec.axis.x;
+    data.gy = gyroscopeDegPerSec.axis.y;
+    data.gz = gyroscopeDegPerSec.axis.z;
+    data.accumulatedGyroX = accumulatedGyroX;
+    data.accumulatedGyroY = accumulatedGyroY;
+    data.accumulatedGyroZ = accumulatedGyroZ;
+    data.fusionRoll = fusionEuler.angle.roll;
+    data.fusionPitch = fusionEuler.angle.pitch;
+    data.fusionYaw = fusionEuler.angle.yaw;
+    data.temperatureC = temperatureC;
+    data.timeSec = lastUpdateMicros / 1e6f;
+    data.rawGx = rawGyroscope.axis.x;
+    data.rawGy = rawGyroscope.axis.y;
+    data.rawGz = rawGyroscope.axis.z;
+    data.predictedRoll = predictedEuler.angle.roll;
+    data.predictedPitch = predictedEuler.angle.pitch;
+    data.predictedYaw = predictedEuler.angle.yaw;
+    data.predictionMs = predictor.getHorizonMs();
+    data.timeMicros = lastUpdateMicros;
+    return data;
+  }
+
+  IMUDiagnostics getDiagnostics() {
+    const FusionAhrsInternalStates states = FusionAhrsGetInternalStates(&g_ahrs);
+    const FusionAhrsFlags flags = FusionAhrsGetFlags(&g_ahrs);
+    IMUDiagnostics diagnostics;
+    diagnostics.accelerationError = states.accelerationError;
+    diagnostics.accelerometerIgnored = states.accelerometerIgnored;
+    diagnostics.accelerationRecoveryTrigger = states.accelerationRecoveryTrigger;
+    diagnostics.initialising = flags.initialising;
+    diagnostics.angularRateRecovery = flags.angularRateRecovery;
+    diagnostics.accelerationRecovery = flags.accelerationRecovery;
+    const FusionVector bias = offset.getBias();
+    diagnostics.gyroBiasX = bias.axis.x;
+    diagnostics.gyroBiasY = bias.axis.y;
+    diagnostics.gyroBiasZ = bias.axis.z;
+    diagnostics.offsetTimer = offset.getTimer();
+    diagnostics.offsetState = offset.getState();
+    diagnostics.offsetCutoff = offset.getCutoffFrequency();
+    diagnostics.driftAngle = drift.angle;
+    diagnostics.driftRate = drift.rate;
+    diagnostics.driftAverageRate = drift.averageRate;
+    diagnostics.timeMicros = lastUpdateMicros;
+    return diagnostics;
+  }
+};
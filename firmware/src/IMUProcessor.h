@@ -1,169 +1,44 @@
 #pragma once
 
 #include <Arduino.h>
-#include <LSM6DS3.h>
+#include "IMUFusion.h"
+#include "IMUSampler.h"
 
-struct IMUData {
-  // accelerometer data - g
-  float ax;
-  float ay;
-  float az;
-  // gyro data - deg/s
-  float gx;
-  float gy;
-  float gz;
-  // accumulated gyro data - deg
-  float accumulatedGyroX;
-  float accumulatedGyroY;
-  float accumulatedGyroZ;
-  // fusion data - deg
-  float fusionRoll;
-  float fusionPitch;
-  float fusionYaw;
-  // temperature - C
-  float temperatureC;
-  // time - seconds
-  float timeSec;
-};
-
-class IMUProcessor {
+// Fusion stage - runs the samples queued by the IMUSampler through the
+// pipeline on the core the transports live on.
+class IMUProcessor : public IMUFusion {
 private:
-  LSM6DS3 *imu;
-  static float wrapAngle(float angle) {
-    while (angle < -180.0f)
-      angle += 360.0f;
-    while (angle > 180.0f)
-      angle -= 360.0f;
-    return angle;
-  }
-
-  // Integrate gyroscope (deg/s) over deltaTime (s) into persistent quaternion
-  // and output Euler angles (deg)
-  void updateGyroIntegration(const FusionVector gyroscopeDegPerSec,
-                                    const float deltaTime) {
-    // Convert deg/s to rad/s
-    const float wx = FusionDegreesToRadians(gyroscopeDegPerSec.axis.x);
-    const float wy = FusionDegreesToRadians(gyroscopeDegPerSec.axis.y);
-    const float wz = FusionDegreesToRadians(gyroscopeDegPerSec.axis.z);
-    const float omegaMag = sqrtf(wx * wx + wy * wy + wz * wz);
-    if (omegaMag > 0.0f && deltaTime > 0.0f) {
-      const float angle = omegaMag * deltaTime; // radians
-      const float halfAngle = 0.5f * angle;
-      const float s = sinf(halfAngle) / omegaMag; // safe because omegaMag>0
-      const float c = cosf(halfAngle);
-      const FusionQuaternion delta = {.element = {
-                                          .w = c,
-                                          .x = wx * s,
-                                          .y = wy * s,
-                                          .z = wz * s,
-                                      }};
-      // q = q * delta
-      gyroQuaternion = FusionQuaternionMultiply(gyroQuaternion, delta);
-      gyroQuaternion = FusionQuaternionNormalise(gyroQuaternion);
-    }
-
-    const FusionEuler gyroEuler = FusionQuaternionToEuler(gyroQuaternion);
-    accumulatedGyroX = wrapAngle(gyroEuler.angle.roll);
-    accumulatedGyroY = wrapAngle(gyroEuler.angle.pitch);
-    accumulatedGyroZ = wrapAngle(gyroEuler.angle.yaw);
-  }
+  // alignment of the samples so far - AXES_ALIGNMENT_COUNT before the first
+  uint8_t axesAlignment = AXES_ALIGNMENT_COUNT;
 
 public:
-  FusionAhrs g_ahrs;
-  FusionEuler fusionEuler;
-  FusionOffset offset;
-  FusionQuaternion gyroQuaternion;
-  FusionVector gyroscopeDegPerSec;
-  FusionVector accelerometer;
-  float temperatureC;
-  float accumulatedGyroX;
-  float accumulatedGyroY;
-  float accumulatedGyroZ;
-  uint32_t lastUpdateMicros = 0;
-
-  IMUProcessor(LSM6DS3 *imu) {
-    this->imu = imu;
-    // Initialise Fusion AHRS
-    FusionAhrsInitialise(&g_ahrs);
-    const FusionAhrsSettings settings = {
-        .convention = FusionConventionNwu,
-        .gain = 0.5f,
-        .gyroscopeRange = 2000.0f,      // deg/s (set to your gyro full-scale)
-        .accelerationRejection = 10.0f, // degrees
-        .magneticRejection = 0.0f,      // no magnetometer in use
-        .recoveryTriggerPeriod = 1000u  // samples (about ~5 s @ 200 Hz)
-    };
-    FusionAhrsSetSettings(&g_ahrs, &settings);
-
-    // you can look in the frontend to see the actual sample rate that messages
-    // are sent at
-    FusionOffsetInitialise(&offset, 200);
+  // stage counters - only written by the fusion stage
+  volatile uint32_t samplesProcessed = 0;
+  // total time spent in fusion - microseconds
+  volatile uint32_t processMicros = 0;
 
+  // sampleRate is the sensor's output data rate - Hz
+  IMUProcessor(unsigned int sampleRate) : IMUFusion(defaultSettings(sampleRate), sampleRate) {
     lastUpdateMicros = micros();
-
-    // Reset pure gyro integrator orientation to identity
-    gyroQuaternion = FUSION_IDENTITY_QUATERNION;
-  }
-
-  void resetGyroIntegration() { 
-    gyroQuaternion = FUSION_IDENTITY_QUATERNION;
-    accumulatedGyroX = 0.0f;
-    accumulatedGyroY = 0.0f;
-    accumulatedGyroZ = 0.0f;
   }
 
-  void update() {
-    // Proceed with sensor sampling
-    temperatureC = imu->readTempC();
-
-    FusionVector gyroscope; // deg/s
-    gyroscope.axis.x = imu->readFloatGyroX();
-    gyroscope.axis.y = imu->readFloatGyroY();
-    gyroscope.axis.z = imu->readFloatGyroZ();
-
-    accelerometer.axis.x = imu->readFloatAccelX();
-    accelerometer.axis.y = imu->readFloatAccelY();
-    accelerometer.axis.z = imu->readFloatAccelZ();
-
-    // Delta time for AHRS update (seconds)
-    const uint32_t now = micros();
-    float deltaTime = (now - lastUpdateMicros) / 1e6f;
-    lastUpdateMicros = now;
-    if (deltaTime <= 0.0f || deltaTime > 0.1f) {
-      // Guard against unreasonable dt (e.g., on startup or USB stall)
-      deltaTime = 0.01f;
+  void update(const IMUSample &sample) {
+    const uint32_t start = micros();
+    // keep the AHRS's overflow detection in step if the sampler escalated
+    if (sample.gyroRange != settings.gyroscopeRange) {
+      setGyroscopeRange(sample.gyroRange);
     }
-
-    // Update gyroscope offset correction algorithm
-    gyroscopeDegPerSec = FusionOffsetUpdate(&offset, gyroscope);
-
-    // update the AHRS
-    FusionAhrsUpdateNoMagnetometer(&g_ahrs, gyroscopeDegPerSec, accelerometer,
-                                   deltaTime);
-
-    // Convert the quaternion to euler angles
-    fusionEuler =
-        FusionQuaternionToEuler(FusionAhrsGetQuaternion(&g_ahrs));
-
-    updateGyroIntegration(gyroscopeDegPerSec, deltaTime);
-  }
-
-  IMUData getData() {
-    IMUData data;
-    data.ax = accelerometer.axis.x;
-    data.ay = accelerometer.axis.y;
-    data.az = accelerometer.axis.z;
-    data.gx = gyroscopeDegPerSec.axis.x;
-    data.gy = gyroscopeDegPerSec.axis.y;
-    data.gz = gyroscopeDegPerSec.axis.z;
-    data.accumulatedGyroX = accumulatedGyroX;
-    data.accumulatedGyroY = accumulatedGyroY;
-    data.accumulatedGyroZ = accumulatedGyroZ;
-    data.fusionRoll = fusionEuler.angle.roll;
-    data.fusionPitch = fusionEuler.angle.pitch;
-    data.fusionYaw = fusionEuler.angle.yaw;
-    data.temperatureC = temperatureC;
-    data.timeSec = lastUpdateMicros / 1e6f;
-    return data;
+    // ALLAN changes the output data rate - the offset and AHRS count in samples
+    if (sample.sampleRate != sampleRate) {
+      setSampleRate(sample.sampleRate);
+    }
+    // the old AHRS and bias are in the previous body frame
+    if (sample.axesAlignment != axesAlignment) {
+      if (axesAlignment < AXES_ALIGNMENT_COUNT) resetOrientation();
+      axesAlignment = sample.axesAlignment;
+    }
+    process(sample.gyroscope, sample.accelerometer, sample.temperatureC, sample.timeMicros);
+    samplesProcessed++;
+    processMicros += micros() - start;
   }
-};
\ No newline at end of file
+};
@@ -0,0 +1,363 @@
+#pragma once
+
+#include <Arduino.h>
+#include <freertos/FreeRTOS.h>
+#include <atomic>
+#include <LSM6DS3.h>
+#include <Preferences.h>
+#include <sstream>
+#include "Fusion.h"
+#include "AxesRemap.h"
+#include "SaturationMonitor.h"
+#include "SpscQueue.h"
+
+// NVS namespace and key for the mounting orientation
+#define IMU_PREFERENCES_NAMESPACE "imu"
+#define IMU_PREFERENCES_AXES_KEY "axes"
+
+// samples waiting for the fusion stage - must be a power of two
+#define IMU_SAMPLE_QUEUE_SIZE 128
+// FIFO_CTRL3: gyro and accel both in the FIFO, no decimation
+#define IMU_FIFO_GYRO_ACCEL 0x09
+// FIFO_CTRL5 mode bits
+#define IMU_FIFO_MODE_BYPASS 0x00
+#define IMU_FIFO_MODE_CONTINUOUS 0x06
+// FIFO_STATUS2 overrun flag
+#define IMU_FIFO_OVERRUN 0x40
+// 16 bit words per sample in the FIFO - gyro xyz then accel xyz
+#define IMU_FIFO_SAMPLE_WORDS 6
+// samples per I2C read - the ESP32 Wire buffer is 128 bytes
+#define IMU_FIFO_READ_SAMPLES 10
+
+// One reading, scaled and in body axes, on its way to the fusion stage
+struct IMUSample {
+  // deg/s before offset correction
+  FusionVector gyroscope;
+  // g
+  FusionVector accelerometer;
+  float temperatureC;
+  // time - microseconds
+  uint32_t timeMicros;
+  // gyro full-scale range it was read with - deg/s
+  uint16_t gyroRange;
+  // FusionAxesAlignment it was remapped with
+  uint8_t axesAlignment;
+  // output data rate it was read at - Hz
+  uint16_t sampleRate;
+};
+
+// Acquisition stage. Runs in its own task on core 0. The sensor collects
+// gyro and accel samples in its FIFO, and every scheduler tick (1 ms) the
+// task reads everything that's built up in a few I2C bursts - so the output
+// data rate isn't limited by how often the task wakes. Each sample gets the
+// mounting orientation and clipping checks and is queued for the fusion stage
+// on the other core.
+class IMUSampler {
+private:
+  LSM6DS3 *imu;
+  // sensor to body axes - applied before anything else sees the data
+  AxesRemap axes;
+  // woken whenever a sample is queued
+  TaskHandle_t consumer = nullptr;
+  // sample period at the current output data rate - microseconds
+  uint32_t periodMicros = 0;
+
+  // raise the full-scale range one step by rewriting the FS bits of the
+  // control register - the library scales readings by settings.*Range so
+  // that has to follow. Returns false if we're already at the top.
+  bool escalateGyroRange() {
+    static const uint16_t ranges[] = {245, 500, 1000, 2000};
+    static const uint8_t fsBits[] = {0x00, 0x04, 0x08, 0x0C};
+    for (int i = 0; i < 4; i++) {
+      if (ranges[i] > imu->settings.gyroRange) {
+        uint8_t ctrl = 0;
+        imu->readRegister(&ctrl, LSM6DS3_ACC_GYRO_CTRL2_G);
+        // clear FS_G and FS_125
+        ctrl = (ctrl & ~0x0E) | fsBits[i];
+        imu->writeRegister(LSM6DS3_ACC_GYRO_CTRL2_G, ctrl);
+        imu->settings.gyroRange = ranges[i];
+        gyroSaturation.escalations++;
+        return true;
+      }
+    }
+    return false;
+  }
+
+  bool escalateAccelRange() {
+    static const uint16_t ranges[] = {2, 4, 8, 16};
+    // FS_XL isn't in range order - 16g is 01
+    static const uint8_t fsBits[] = {0x00, 0x08, 0x0C, 0x04};
+    for (int i = 0; i < 4; i++) {
+      if (ranges[i] > imu->settings.accelRange) {
+        uint8_t ctrl = 0;
+        imu->readRegister(&ctrl, LSM6DS3_ACC_GYRO_CTRL1_XL);
+        ctrl = (ctrl & ~0x0C) | fsBits[i];
+        imu->writeRegister(LSM6DS3_ACC_GYRO_CTRL1_XL, ctrl);
+        imu->settings.accelRange = ranges[i];
+        accelSaturation.escalations++;
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // ODR_XL/ODR_G field (top nibble of CTRL1_XL and CTRL2_G) for a rate in
+  // Hz, 0 if we don't support it. ODR_FIFO uses the same codes. 1.66 kHz is
+  // the gyro's fastest rate; the accelerometer goes higher but 12 bytes a
+  // sample at 3.33 kHz is more than a 400 kHz I2C bus can carry.
+  static uint8_t odrBits(uint16_t hz) {
+    static const uint16_t rates[] = {13, 26, 52, 104, 208, 416, 833, 1660};
+    for (int i = 0; i < 8; i++) {
+      if (rates[i] == hz) return (uint8_t)((i + 1) << 4);
+    }
+    return 0;
+  }
+
+  // empties the FIFO and starts it collecting at the current rate - sampler
+  // task only
+  void restartFifo() {
+    const uint8_t odr = odrBits(imu->settings.gyroSampleRate) >> 1;
+    imu->writeRegister(LSM6DS3_ACC_GYRO_FIFO_CTRL5, odr | IMU_FIFO_MODE_BYPASS);
+    imu->writeRegister(LSM6DS3_ACC_GYRO_FIFO_CTRL3, IMU_FIFO_GYRO_ACCEL);
+    imu->writeRegister(LSM6DS3_ACC_GYRO_FIFO_CTRL5, odr | IMU_FIFO_MODE_CONTINUOUS);
+    periodMicros = 1000000u / imu->settings.gyroSampleRate;
+  }
+
+  // sampler task only
+  void applySampleRate(uint16_t hz) {
+    const uint8_t odr = odrBits(hz);
+    uint8_t ctrl = 0;
+    imu->readRegister(&ctrl, LSM6DS3_ACC_GYRO_CTRL1_XL);
+    imu->writeRegister(LSM6DS3_ACC_GYRO_CTRL1_XL, (ctrl & 0x0F) | odr);
+    imu->readRegister(&ctrl, LSM6DS3_ACC_GYRO_CTRL2_G);
+    imu->writeRegister(LSM6DS3_ACC_GYRO_CTRL2_G, (ctrl & 0x0F) | odr);
+    imu->settings.gyroSampleRate = hz;
+    imu->settings.accelSampleRate = hz;
+    restartFifo();
+  }
+
+  static void encodeSaturation(std::stringstream &ss, const SaturationMonitor &monitor, uint16_t range) {
+    static const char *const names[3] = {"x", "y", "z"};
+    ss << "{\"range\":" << range << ",\"escalations\":" << monitor.escalations;
+    for (int i = 0; i < 3; i++) {
+      ss << ",\"" << names[i] << "\":{\"count\":" << monitor.axes[i].count;
+      ss << ",\"lastUs\":" << monitor.axes[i].lastMicros << "}";
+    }
+    ss << "}";
+  }
+
+  static void task(void *pvParameter) {
+    IMUSampler *sampler = static_cast<IMUSampler *>(pvParameter);
+    sampler->restartFifo();
+    while (true) {
+      const uint16_t rate = sampler->pendingSampleRate.exchange(0);
+      if (rate) sampler->applySampleRate(rate);
+      // only ever between samples, so gyro and accel always share a frame
+      const uint8_t alignment = sampler->pendingAxesAlignment.exchange(AXES_ALIGNMENT_COUNT);
+      if (alignment < AXES_ALIGNMENT_COUNT) sampler->axes.set((FusionAxesAlignment)alignment);
+      if (sampler->pendingSaturationReset.load()) {
+        sampler->gyroSaturation.reset();
+        sampler->accelSaturation.reset();
+        sampler->pendingSaturationReset.store(false);
+      }
+      sampler->readFifo();
+      // the FIFO holds the samples until we're back
+      vTaskDelay(1);
+    }
+  }
+
+  // scale, remap and queue one sample - raw is gyro xyz then accel xyz.
+  // Returns false if a range change emptied the FIFO.
+  bool queueSample(const int16_t raw[IMU_FIFO_SAMPLE_WORDS], float temperatureC, uint32_t timeMicros) {
+    const int16_t *rawGyro = raw;
+    const int16_t *rawAccel = raw + 3;
+
+    FusionVector gyroscope; // deg/s
+    gyroscope.axis.x = imu->calcGyro(rawGyro[0]);
+    gyroscope.axis.y = imu->calcGyro(rawGyro[1]);
+    gyroscope.axis.z = imu->calcGyro(rawGyro[2]);
+
+    FusionVector accel; // g
+    accel.axis.x = imu->calcAccel(rawAccel[0]);
+    accel.axis.y = imu->calcAccel(rawAccel[1]);
+    accel.axis.z = imu->calcAccel(rawAccel[2]);
+
+    IMUSample sample;
+    sample.gyroscope = axes.apply(gyroscope);
+    sample.accelerometer = axes.apply(accel);
+    sample.temperatureC = temperatureC;
+    sample.timeMicros = timeMicros;
+    sample.gyroRange = imu->settings.gyroRange;
+    sample.axesAlignment = (uint8_t)axes.get();
+    sample.sampleRate = imu->settings.gyroSampleRate;
+    samplesRead++;
+    if (samples.push(sample) && consumer) {
+      xTaskNotifyGive(consumer);
+    }
+
+    // if clipping keeps happening go up a range. Samples already in the FIFO
+    // were taken at the old range, so they're thrown away.
+    bool escalated = false;
+    if (gyroSaturation.update(rawGyro, timeMicros) && !rangesLocked) escalated |= escalateGyroRange();
+    if (accelSaturation.update(rawAccel, timeMicros) && !rangesLocked) escalated |= escalateAccelRange();
+    if (escalated) restartFifo();
+    return !escalated;
+  }
+
+public:
+  SpscQueue<IMUSample, IMU_SAMPLE_QUEUE_SIZE> samples;
+  // clipping counters for the raw gyro and accelerometer counts
+  SaturationMonitor gyroSaturation;
+  SaturationMonitor accelSaturation;
+  // stage counters - only written by the sampler task
+  volatile uint32_t samplesRead = 0;
+  volatile uint32_t readErrors = 0;
+  // times the FIFO filled up before we got to it
+  volatile uint32_t fifoOverruns = 0;
+  // total time spent reading - microseconds
+  volatile uint32_t readMicros = 0;
+  // keep the current full-scale ranges even if the sensor clips - for noise
+  // characterisation, where a range change would change the noise floor
+  volatile bool rangesLocked = false;
+  // ODR change waiting for the sampler task (it owns the bus) - 0 if none
+  std::atomic<uint16_t> pendingSampleRate;
+  // clipping counter reset waiting for the sampler task (it writes them)
+  std::atomic<bool> pendingSaturationReset;
+  // mounting orientation waiting for the sampler task - AXES_ALIGNMENT_COUNT
+  // if none
+  std::atomic<uint8_t> pendingAxesAlignment;
+
+  IMUSampler(LSM6DS3 *imu)
+      : pendingSampleRate(0), pendingSaturationReset(false), pendingAxesAlignment(AXES_ALIGNMENT_COUNT) {
+    this->imu = imu;
+
+    Preferences preferences;
+    preferences.begin(IMU_PREFERENCES_NAMESPACE, true);
+    const uint8_t alignment = preferences.getUChar(IMU_PREFERENCES_AXES_KEY, FusionAxesAlignmentPXPYPZ);
+    preferences.end();
+    if (alignment < AXES_ALIGNMENT_COUNT) {
+      axes.set((FusionAxesAlignment)alignment);
+    }
+  }
+
+  // start sampling, waking consumer each time a sample is queued
+  void begin(TaskHandle_t consumer) {
+    this->consumer = consumer;
+    xTaskCreatePinnedToCore(task, "IMUSampler", 4096, this, 3, nullptr, 0);
+  }
+
+  // sensor output data rate - Hz
+  unsigned int getSampleRate() {
+    return imu->settings.gyroSampleRate;
+  }
+
+  // change the gyro and accel output data rate - 13 to 1660 Hz. Applied by
+  // the sampler task before its next read; false if the rate isn't supported.
+  bool setSampleRate(uint16_t hz) {
+    if (!odrBits(hz)) return false;
+    pendingSampleRate.store(hz);
+    return true;
+  }
+
+  // clear the clipping counters - done by the sampler task before its next
+  // read, waits (briefly) for it so the counters read back cleared
+  void resetSaturation() {
+    pendingSaturationReset.store(true);
+    for (int i = 0; i < 10 && pendingSaturationReset.load(); i++) vTaskDelay(1);
+  }
+
+  // the alignment most recently set, even if the sampler hasn't picked it up
+  FusionAxesAlignment getAxesAlignment() {
+    const uint8_t pending = pendingAxesAlignment.load();
+    return pending < AXES_ALIGNMENT_COUNT ? (FusionAxesAlignment)pending : axes.get();
+  }
+
+  // change the mounting orientation and remember it across reboots. The
+  // sampler task switches over before its next read; samples say which
+  // alignment they were remapped with so fusion can start again.
+  void setAxesAlignment(FusionAxesAlignment alignment) {
+    pendingAxesAlignment.store((uint8_t)alignment);
+    Preferences preferences;
+    preferences.begin(IMU_PREFERENCES_NAMESPACE, false);
+    preferences.putUChar(IMU_PREFERENCES_AXES_KEY, (uint8_t)alignment);
+    preferences.end();
+  }
+
+  // {"saturation":{"gyro":{"range":2000,"escalations":0,"x":{"count":0,"lastUs":0},...},"accel":{...}}}
+  std::string saturationJson() {
+    std::stringstream ss;
+    ss << "{\"saturation\":{\"gyro\":";
+    encodeSaturation(ss, gyroSaturation, imu->settings.gyroRange);
+    ss << ",\"accel\":";
+    encodeSaturation(ss, accelSaturation, imu->settings.accelRange);
+    ss << "}}";
+    return ss.str();
+  }
+
+  // reads and queues everything in the FIFO, returns the samples read
+  size_t readFifo() {
+    // DIFF_FIFO (unread words), overrun flag and FIFO_PATTERN (the next word)
+    uint8_t status[4];
+    if (imu->readRegisterRegion(status, LSM6DS3_ACC_GYRO_FIFO_STATUS1, sizeof(status)) != IMU_SUCCESS) {
+      readErrors++;
+      return 0;
+    }
+    const uint32_t now = micros();
+    if (status[1] & IMU_FIFO_OVERRUN) {
+      // we fell a whole FIFO behind - the timing of what's in it is lost
+      fifoOverruns++;
+      restartFifo();
+      return 0;
+    }
+    size_t words = ((status[1] & 0x0F) << 8) | status[0];
+    const uint16_t pattern = ((status[3] & 0x03) << 8) | status[2];
+    const uint32_t start = micros();
+    if (pattern != 0) {
+      // part way through a sample (only after an error) - skip to the next
+      uint8_t skip[2];
+      for (uint16_t i = pattern; i < IMU_FIFO_SAMPLE_WORDS && words > 0; i++, words--) {
+        imu->readRegisterRegion(skip, LSM6DS3_ACC_GYRO_FIFO_DATA_OUT_L, sizeof(skip));
+      }
+    }
+    const size_t count = words / IMU_FIFO_SAMPLE_WORDS;
+    if (count == 0) return 0;
+
+    // temperature isn't in the FIFO - one reading does for the batch
+    uint8_t temperature[2];
+    float temperatureC = 25.0f;
+    if (imu->readRegisterRegion(temperature, LSM6DS3_ACC_GYRO_OUT_TEMP_L, sizeof(temperature)) == IMU_SUCCESS) {
+      // 16 LSB per degree, 0 is 25C
+      temperatureC = (int16_t)(temperature[0] | (temperature[1] << 8)) / 16.0f + 25.0f;
+    }
+
+    // the newest sample was taken just before now and the rest one period
+    // apart before it
+    uint8_t buffer[IMU_FIFO_READ_SAMPLES * IMU_FIFO_SAMPLE_WORDS * 2];
+    size_t done = 0;
+    while (done < count) {
+      const size_t batch = count - done < IMU_FIFO_READ_SAMPLES ? count - done : IMU_FIFO_READ_SAMPLES;
+      // the address wraps from FIFO_DATA_OUT_H back to _L, so one read
+      // drains as many words as we ask for
+      if (imu->readRegisterRegion(buffer, LSM6DS3_ACC_GYRO_FIFO_DATA_OUT_L,
+                                  batch * IMU_FIFO_SAMPLE_WORDS * 2) != IMU_SUCCESS) {
+        readErrors++;
+        break;
+      }
+      for (size_t i = 0; i < batch; i++) {
+        int16_t raw[IMU_FIFO_SAMPLE_WORDS];
+        const uint8_t *bytes = buffer + i * IMU_FIFO_SAMPLE_WORDS * 2;
+        for (int w = 0; w < IMU_FIFO_SAMPLE_WORDS; w++) {
+          raw[w] = (int16_t)(bytes[2 * w] | (bytes[2 * w + 1] << 8));
+        }
+        const uint32_t age = (uint32_t)(count - 1 - (done + i)) * periodMicros;
+        if (!queueSample(raw, temperatureC, now - age)) {
+          readMicros += micros() - start;
+          return done + i + 1;
+        }
+      }
+      done += batch;
+    }
+    readMicros += micros() - start;
+    return done;
+  }
+};
@@ -0,0 +1,77 @@
+#pragma once
+
+// Decides whether the device is stationary or moving. A sample looks like
+// motion if any corrected gyro axis is above FusionOffset's stillness
+// threshold or the accelerometer magnitude is varying. It takes a short run
+// of motion to go MOVING and a quiet spell to go back to STATIONARY, so single
+// spikes don't produce a flurry of transitions. Everything is timed from the
+// sample timestamps, so it behaves the same at any output data rate.
+
+#include "Fusion.h"
+#include <math.h>
+#include <stdint.h>
+
+// same threshold FusionOffset uses to decide the gyro is still - deg/s
+#define MOTION_GYRO_THRESHOLD 3.0f
+// variance of the accelerometer magnitude that counts as motion - g^2
+#define MOTION_ACCEL_VARIANCE_THRESHOLD 0.0004f
+// time constant of the running mean/variance of the accelerometer magnitude -
+// microseconds
+#define MOTION_ACCEL_TIME_CONSTANT_MICROS 50000.0f
+// motion without a break needed to go MOVING - microseconds
+#define MOTION_MOVING_MICROS 10000
+// quiet time needed to go STATIONARY - microseconds
+#define MOTION_STATIONARY_MICROS 500000
+
+class MotionClassifier {
+private:
+  float accelMean = 1.0f;
+  float accelVariance = 0.0f;
+  bool inMotion = false;
+  uint32_t motionStartMicros = 0;
+  uint32_t lastMotionMicros = 0;
+  uint32_t lastUpdateMicros = 0;
+  uint32_t stateStartMicros = 0;
+  bool started = false;
+
+public:
+  bool moving = false;
+  // how long (s) we were in the previous state, set on each transition
+  float previousDuration = 0.0f;
+
+  // returns true when the state changes
+  bool update(const FusionVector gyroscope, const FusionVector accelerometer, const uint32_t nowMicros) {
+    if (!started) {
+      started = true;
+      accelMean = FusionVectorMagnitude(accelerometer);
+      lastMotionMicros = nowMicros;
+      lastUpdateMicros = nowMicros;
+      stateStartMicros = nowMicros;
+    }
+    const float dt = (float)(nowMicros - lastUpdateMicros);
+    lastUpdateMicros = nowMicros;
+    const float smoothing = dt / (MOTION_ACCEL_TIME_CONSTANT_MICROS + dt);
+    const float magnitude = FusionVectorMagnitude(accelerometer);
+    const float deviation = magnitude - accelMean;
+    accelMean += smoothing * deviation;
+    accelVariance += smoothing * (deviation * deviation - accelVariance);
+
+    const bool motion = fabsf(gyroscope.axis.x) > MOTION_GYRO_THRESHOLD ||
+                        fabsf(gyroscope.axis.y) > MOTION_GYRO_THRESHOLD ||
+                        fabsf(gyroscope.axis.z) > MOTION_GYRO_THRESHOLD ||
+                        accelVariance > MOTION_ACCEL_VARIANCE_THRESHOLD;
+    if (motion) {
+      if (!inMotion) motionStartMicros = nowMicros;
+      lastMotionMicros = nowMicros;
+    }
+    inMotion = motion;
+
+    const bool next = moving ? nowMicros - lastMotionMicros < MOTION_STATIONARY_MICROS
+                             : inMotion && nowMicros - motionStartMicros >= MOTION_MOVING_MICROS;
+    if (next == moving) return false;
+    moving = next;
+    previousDuration = (nowMicros - stateStartMicros) / 1e6f;
+    stateStartMicros = nowMicros;
+    return true;
+  }
+};
@@ -0,0 +1,57 @@
+#pragma once
+
+// Extrapolates the fused orientation forward in time so display clients can
+// hide their transport and render latency. The prediction assumes the
+// current (offset-corrected) angular rate holds for the whole horizon, which
+// is a good guess over the tens of milliseconds a BLE link adds and much
+// better than showing where the device was.
+
+#include "Fusion.h"
+#include <atomic>
+#include <math.h>
+#include <stdint.h>
+
+// longest horizon we'll extrapolate over - beyond this constant rate is a
+// poor guess and the model overshoots visibly
+#define PREDICTION_MAX_HORIZON_MS 200
+
+class OrientationPredictor {
+private:
+  // set from the command tasks, read by the fusion stage
+  std::atomic<uint32_t> horizonMicros{0};
+
+public:
+  // rotate orientation by gyroscope (body frame, deg/s) held for horizon (s)
+  static FusionQuaternion predict(const FusionQuaternion orientation, const FusionVector gyroscope,
+                                  const float horizon) {
+    const FusionVector halfAngle = FusionVectorMultiplyScalar(gyroscope, FusionDegreesToRadians(0.5f * horizon));
+    const float magnitude = FusionVectorMagnitude(halfAngle);
+    if (magnitude <= 0.0f) {
+      return orientation;
+    }
+    const float s = sinf(magnitude) / magnitude;
+    const FusionQuaternion delta = {.element = {
+                                        .w = cosf(magnitude),
+                                        .x = halfAngle.axis.x * s,
+                                        .y = halfAngle.axis.y * s,
+                                        .z = halfAngle.axis.z * s,
+                                    }};
+    return FusionQuaternionNormalise(FusionQuaternionMultiply(orientation, delta));
+  }
+
+  // 0 turns prediction off, longer horizons are clamped
+  void setHorizonMs(float ms) {
+    if (ms < 0.0f) ms = 0.0f;
+    if (ms > PREDICTION_MAX_HORIZON_MS) ms = PREDICTION_MAX_HORIZON_MS;
+    horizonMicros = (uint32_t)(ms * 1000.0f);
+  }
+
+  float getHorizonMs() const {
+    return horizonMicros / 1000.0f;
+  }
+
+  FusionQuaternion update(const FusionQuaternion orientation, const FusionVector gyroscope) const {
+    const uint32_t horizon = horizonMicros;
+    return horizon ? predict(orientation, gyroscope, horizon / 1e6f) : orientation;
+  }
+};
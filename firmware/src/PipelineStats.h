@@ -0,0 +1,96 @@
+#pragma once
+
+#include <Arduino.h>
+#include <map>
+#include <sstream>
+#include "IMUSampler.h"
+#include "IMUProcessor.h"
+#include "TransportManager.h"
+
+// Throughput of each pipeline stage since the last reset, for the PIPELINE
+// command. The stages own their counters; this just remembers where they were
+// at the reset and reports the difference, so nothing is ever written from
+// another task.
+class PipelineStats {
+private:
+  IMUSampler *sampler;
+  IMUProcessor *processor;
+  TransportManager *transports;
+
+  uint32_t startMicros = 0;
+  uint32_t samplesRead = 0;
+  uint32_t readMicros = 0;
+  uint32_t readErrors = 0;
+  uint32_t fifoOverruns = 0;
+  uint32_t dropped = 0;
+  uint32_t samplesProcessed = 0;
+  uint32_t processMicros = 0;
+  uint32_t burstsSent = 0;
+  uint32_t burstsDropped = 0;
+  uint32_t repliesDropped = 0;
+  std::map<Transport *, uint32_t> transmitted;
+  std::map<Transport *, uint32_t> droppedSamples;
+
+  static float average(uint32_t total, uint32_t count) {
+    return count > 0 ? (float)total / count : 0.0f;
+  }
+
+public:
+  PipelineStats(IMUSampler *sampler, IMUProcessor *processor, TransportManager *transports) {
+    this->sampler = sampler;
+    this->processor = processor;
+    this->transports = transports;
+    reset();
+  }
+
+  void reset() {
+    startMicros = micros();
+    samplesRead = sampler->samplesRead;
+    readMicros = sampler->readMicros;
+    readErrors = sampler->readErrors;
+    fifoOverruns = sampler->fifoOverruns;
+    dropped = sampler->samples.dropped;
+    samplesProcessed = processor->samplesProcessed;
+    processMicros = processor->processMicros;
+    burstsSent = transports->burstsSent;
+    burstsDropped = transports->burstsDropped;
+    repliesDropped = transports->repliesDropped;
+    transports->forEach([this](Transport *transport) {
+      transmitted[transport] = transport->transmitted;
+      droppedSamples[transport] = transport->droppedSamples();
+    });
+  }
+
+  // {"pipeline":{"seconds":1.5,"acquisition":{...},"fusion":{...},"transports":{...},"bursts":{...},"replies":{...}}}
+  std::string toJson() {
+    const float seconds = (micros() - startMicros) / 1e6f;
+    const uint32_t read = sampler->samplesRead - samplesRead;
+    const uint32_t processed = processor->samplesProcessed - samplesProcessed;
+    std::stringstream ss;
+    ss << "{\"pipeline\":{\"seconds\":" << seconds;
+    ss << ",\"acquisition\":{\"samples\":" << read;
+    ss << ",\"rate\":" << read / seconds;
+    ss << ",\"avgUs\":" << average(sampler->readMicros - readMicros, read);
+    ss << ",\"dropped\":" << sampler->samples.dropped - dropped;
+    ss << ",\"errors\":" << sampler->readErrors - readErrors;
+    ss << ",\"overruns\":" << sampler->fifoOverruns - fifoOverruns;
+    ss << "},\"fusion\":{\"samples\":" << processed;
+    ss << ",\"rate\":" << processed / seconds;
+    ss << ",\"avgUs\":" << average(processor->processMicros - processMicros, processed);
+    ss << ",\"queued\":" << sampler->samples.size();
+    ss << "},\"transports\":{";
+    bool first = true;
+    transports->forEach([&](Transport *transport) {
+      const uint32_t sent = transport->transmitted - transmitted[transport];
+      if (!first) ss << ",";
+      first = false;
+      ss << "\"" << transport->getName() << "\":{\"sent\":" << sent << ",\"rate\":" << sent / seconds;
+      ss << ",\"dropped\":" << transport->droppedSamples() - droppedSamples[transport] << "}";
+    });
+    ss << "},\"bursts\":{\"sent\":" << transports->burstsSent - burstsSent;
+    ss << ",\"dropped\":" << transports->burstsDropped - burstsDropped;
+    ss << "},\"replies\":{\"dropped\":" << transports->repliesDropped - repliesDropped;
+    ss << "}}}";
+    return ss.str();
+  }
+};
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// raw counts at or beyond this are treated as clipped (full scale is +/-32767)
+#define SATURATION_RAW_THRESHOLD 32500
+// go up a range once this many samples clip within one window
+#define SATURATION_ESCALATE_SAMPLES 20
+#define SATURATION_WINDOW_MICROS 1000000
+
+struct AxisClipping {
+  // number of clipped samples
+  uint32_t count;
+  // time of the most recent one - microseconds
+  uint32_t lastMicros;
+};
+
+// Per-axis clipping detection on the raw counts of one 3-axis sensor
+class SaturationMonitor {
+private:
+  uint32_t windowStart = 0;
+  uint16_t windowClips = 0;
+
+public:
+  AxisClipping axes[3];
+  // how many times the range has been raised
+  uint32_t escalations = 0;
+
+  SaturationMonitor() {
+    reset();
+  }
+
+  void reset() {
+    memset(axes, 0, sizeof(axes));
+    windowStart = 0;
+    windowClips = 0;
+    escalations = 0;
+  }
+
+  // returns true when clipping has persisted long enough that the full-scale
+  // range should be raised
+  bool update(const int16_t raw[3], uint32_t nowMicros) {
+    bool clipped = false;
+    for (int i = 0; i < 3; i++) {
+      if (abs(raw[i]) >= SATURATION_RAW_THRESHOLD) {
+        axes[i].count++;
+        axes[i].lastMicros = nowMicros;
+        clipped = true;
+      }
+    }
+    if (nowMicros - windowStart > SATURATION_WINDOW_MICROS) {
+      windowStart = nowMicros;
+      windowClips = 0;
+    }
+    if (clipped && ++windowClips >= SATURATION_ESCALATE_SAMPLES) {
+      windowStart = nowMicros;
+      windowClips = 0;
+      return true;
+    }
+    return false;
+  }
+};
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <atomic>
+#include <stdint.h>
+#include <string.h>
+
+// Single-writer latest-value publication. The writer never blocks and readers
+// never block the writer - a reader that races with a write simply retries
+// its copy. The sequence number is odd while a write is in progress and
+// also tells readers whether anything new has been published.
+template <typename T>
+class SeqLock {
+private:
+  std::atomic<uint32_t> sequence;
+  T value;
+
+public:
+  SeqLock() : sequence(0) {
+    memset(&value, 0, sizeof(value));
+  }
+
+  // only call from one task
+  void write(const T &newValue) {
+    const uint32_t seq = sequence.load(std::memory_order_relaxed);
+    sequence.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    memcpy(&value, &newValue, sizeof(T));
+    sequence.store(seq + 2, std::memory_order_release);
+  }
+
+  // copies a consistent snapshot into out and returns its sequence number
+  uint32_t read(T &out) const {
+    while (true) {
+      const uint32_t before = sequence.load(std::memory_order_acquire);
+      if (before & 1) continue; // write in progress
+      memcpy(&out, &value, sizeof(T));
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if (sequence.load(std::memory_order_relaxed) == before) return before;
+    }
+  }
+
+  // like read() but only copies if something was written since lastSequence,
+  // which is updated on success
+  bool readIfChanged(T &out, uint32_t &lastSequence) const {
+    if (sequence.load(std::memory_order_acquire) == lastSequence) return false;
+    lastSequence = read(out);
+    return true;
+  }
+};
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <Arduino.h>
+#include <freertos/FreeRTOS.h>
+#include <ctype.h>
+#include "CommandProcessor.h"
+
+// the S3 dev boards use the USB-Serial-JTAG peripheral (HWCDC) for Serial,
+// otherwise it's TinyUSB (USBCDC) - both raise an event when data arrives
+#if ARDUINO_USB_MODE
+#define SERIAL_RX_EVENT ARDUINO_HW_CDC_RX_EVENT
+#else
+#define SERIAL_RX_EVENT ARDUINO_USB_CDC_RX_EVENT
+#endif
+
+// Reads serial commands as soon as they arrive instead of waiting for the
+// serial transport to send something. The USB CDC receive event assembles
+// complete lines and posts them to the CommandProcessor, which runs them on
+// the IMU loop - so a slow command never holds up the USB event loop.
+class SerialCommandReader {
+private:
+  // the CDC event callback doesn't let us pass a context pointer
+  static inline SerialCommandReader *instance = nullptr;
+
+  CommandProcessor *commands;
+  char line[COMMAND_MAX_LENGTH + 1];
+  size_t lineLength = 0;
+  bool overflowed = false;
+
+  static void onReceive(void *, esp_event_base_t, int32_t, void *) {
+    if (instance) instance->readAvailable();
+  }
+
+  void readAvailable() {
+    while (Serial.available() > 0) {
+      int b = Serial.read();
+      if (b < 0) break;
+      char c = (char)b;
+      if (c == '\n' || c == '\r') {
+        // Ignore lines that were too long
+        if (!overflowed) pushLine();
+        lineLength = 0;
+        overflowed = false;
+      } else if (lineLength < COMMAND_MAX_LENGTH) {
+        line[lineLength++] = (char)toupper((unsigned char)c);
+      } else {
+        // Avoid unbounded growth
+        overflowed = true;
+      }
+    }
+  }
+
+  void pushLine() {
+    // trim whitespace
+    size_t start = 0, end = lineLength;
+    while (start < end && isspace((unsigned char)line[start])) start++;
+    while (end > start && isspace((unsigned char)line[end - 1])) end--;
+    if (start == end) return;
+    // dropped rather than stall the USB stack if we're backed up
+    commands->post(std::string(line + start, end - start));
+  }
+
+public:
+  SerialCommandReader(CommandProcessor *commands) {
+    this->commands = commands;
+  }
+
+  void begin() {
+    instance = this;
+    Serial.onEvent(SERIAL_RX_EVENT, onReceive);
+  }
+};
+
@@ -1,13 +1,63 @@
 #pragma once
 
 #include "Transport.h"
+#include "AllanCapture.h"
+#include "SpscQueue.h"
 #include <sstream>
 
+// STREAM_RAW samples waiting to be sent - must be a power of two. About
+// 150 ms at the fastest rate, plenty for one transport interval.
+#define SERIAL_RAW_QUEUE_SIZE 256
+
 class SerialTransport : public Transport {
 public:
-  SerialTransport(Transport::ResetGyroHandler onResetGyro): Transport("SerialTransport", onResetGyro) {
+  enum StreamMode {
+    // the normal JSON sample stream
+    STREAM_MODE_JSON,
+    // uncorrected sensor values as CSV for offline replay (see tools/fusion_sweep)
+    STREAM_MODE_RAW,
+    // no samples at all - just events
+    STREAM_MODE_EVENTS,
+  };
+
+private:
+  volatile StreamMode mode = STREAM_MODE_JSON;
+  // while it's running every sample goes out instead of the normal stream
+  AllanCapture *allan = nullptr;
+
+public:
+  // every sample from the IMU loop while in STREAM_RAW - the sensor runs much
+  // faster than the transport interval, so the latest-sample snapshot the
+  // other modes send would skip most of them
+  SpscQueue<IMUSample, SERIAL_RAW_QUEUE_SIZE> rawSamples;
+
+  SerialTransport(CommandProcessor *commands): Transport("SerialTransport", commands) {
+    commands->registerCommand("STREAM_RAW", [this](const std::string &) { mode = STREAM_MODE_RAW; });
+    commands->registerCommand("STREAM_JSON", [this](const std::string &) { mode = STREAM_MODE_JSON; });
+    commands->registerCommand("STREAM_EVENTS", [this](const std::string &) { mode = STREAM_MODE_EVENTS; });
   }
-  void transmit() override {
+
+  // time_us,gx,gy,gz,ax,ay,az,temp - gyro in deg/s before offset correction
+  static std::string encodeRaw(const IMUData &data) {
+    std::stringstream ss;
+    ss << data.timeMicros << ',';
+    ss << data.rawGx << ',' << data.rawGy << ',' << data.rawGz << ',';
+    ss << data.ax << ',' << data.ay << ',' << data.az << ',';
+    ss << data.temperatureC;
+    return ss.str();
+  }
+
+  // the same line for a sample straight from the sampler
+  static std::string encodeRaw(const IMUSample &sample) {
+    std::stringstream ss;
+    ss << sample.timeMicros << ',';
+    ss << sample.gyroscope.axis.x << ',' << sample.gyroscope.axis.y << ',' << sample.gyroscope.axis.z << ',';
+    ss << sample.accelerometer.axis.x << ',' << sample.accelerometer.axis.y << ',' << sample.accelerometer.axis.z << ',';
+    ss << sample.temperatureC;
+    return ss.str();
+  }
+
+  static std::string encodeJson(const IMUData &data) {
     std::stringstream ss;
     ss << "{\"accel\":{\"x\":";
     ss << data.ax;
@@ -35,35 +85,141 @@ public:
     ss << data.accumulatedGyroY;
     ss << ",\"yaw\":";
     ss << data.accumulatedGyroZ;
+    if (data.predictionMs > 0.0f) {
+      ss << "},\"predicted\":{\"roll\":";
+      ss << data.predictedRoll;
+      ss << ",\"pitch\":";
+      ss << data.predictedPitch;
+      ss << ",\"yaw\":";
+      ss << data.predictedYaw;
+      ss << ",\"ms\":";
+      ss << data.predictionMs;
+    }
     ss << "},\"t\":";
     ss << data.timeSec;
     ss << "}";
-    std::string s = ss.str();
-    Serial.println(s.c_str());
-    Serial.flush();
+    return ss.str();
+  }
+
+  static std::string encodeDiagnostics(const IMUDiagnostics &diagnostics) {
+    std::stringstream ss;
+    ss << std::boolalpha;
+    ss << "{\"diag\":{\"accelerationError\":";
+    ss << diagnostics.accelerationError;
+    ss << ",\"accelerometerIgnored\":";
+    ss << diagnostics.accelerometerIgnored;
+    ss << ",\"accelerationRecoveryTrigger\":";
+    ss << diagnostics.accelerationRecoveryTrigger;
+    ss << ",\"initialising\":";
+    ss << diagnostics.initialising;
+    ss << ",\"angularRateRecovery\":";
+    ss << diagnostics.angularRateRecovery;
+    ss << ",\"accelerationRecovery\":";
+    ss << diagnostics.accelerationRecovery;
+    ss << ",\"gyroBias\":{\"x\":";
+    ss << diagnostics.gyroBiasX;
+    ss << ",\"y\":";
+    ss << diagnostics.gyroBiasY;
+    ss << ",\"z\":";
+    ss << diagnostics.gyroBiasZ;
+    ss << "},\"offsetTimer\":";
+    ss << diagnostics.offsetTimer;
+    ss << ",\"offsetState\":";
+    ss << diagnostics.offsetState;
+    ss << ",\"offsetCutoff\":";
+    ss << diagnostics.offsetCutoff;
+    ss << ",\"drift\":{\"angle\":";
+    ss << diagnostics.driftAngle;
+    ss << ",\"rate\":";
+    ss << diagnostics.driftRate;
+    ss << ",\"averageRate\":";
+    ss << diagnostics.driftAverageRate;
+    ss << "}";
+    ss << ",\"t\":";
+    ss << diagnostics.timeMicros / 1e6f;
+    ss << "}}";
+    return ss.str();
+  }
 
-    
-    // check for any serial commands
-    static String serialCmdBuffer;
-    while (Serial.available() > 0) {
-      int b = Serial.read();
-      if (b < 0) break;
-      char c = (char)b;
-      if (c == '\n' || c == '\r') {
-        String line = serialCmdBuffer;
-        serialCmdBuffer = "";
-        line.trim();
-        line.toUpperCase();
-        processCommand(line.c_str());
-      } else {
-        // Avoid unbounded growth
-        if (serialCmdBuffer.length() < 128) {
-          serialCmdBuffer += c;
-        } else {
-          // Reset buffer if too long without newline
-          serialCmdBuffer = "";
+  // {"event":{"type":"MOVING","id":0,"value":1.5,"us":123456789}}
+  static std::string encodeEvent(const IMUEvent &event) {
+    std::stringstream ss;
+    ss << "{\"event\":{\"type\":\"";
+    ss << IMUEvent::typeName(event.type);
+    ss << "\",\"id\":";
+    ss << (int)event.id;
+    ss << ",\"value\":";
+    ss << event.value;
+    ss << ",\"us\":";
+    ss << event.timeMicros;
+    ss << "}}";
+    return ss.str();
+  }
+
+  void setAllanCapture(AllanCapture *allan) {
+    this->allan = allan;
+  }
+
+  uint32_t droppedSamples() override {
+    return rawSamples.dropped.load();
+  }
+
+  // IMU loop - every sample, straight from the sampler
+  void record(const IMUSample &sample) {
+    if (active && mode == STREAM_MODE_RAW) rawSamples.push(sample);
+  }
+
+  void transmit() override {
+    IMUSample sample;
+    if (allan) {
+      if (allan->isRunning()) {
+        while (allan->samples.pop(sample)) {
+          Serial.println(encodeRaw(sample).c_str());
         }
+        // the capture sends the same lines - don't repeat them afterwards
+        while (rawSamples.pop(sample)) {}
+        Serial.flush();
+        return;
+      }
+      // leftovers from a capture that has stopped
+      while (allan->samples.pop(sample)) {}
+    }
+    if (mode == STREAM_MODE_RAW) {
+      while (rawSamples.pop(sample)) {
+        Serial.println(encodeRaw(sample).c_str());
       }
-    } 
+      Serial.flush();
+      return;
+    }
+    // leftovers from before a switch out of STREAM_RAW
+    while (rawSamples.pop(sample)) {}
+    if (mode == STREAM_MODE_EVENTS) return;
+    Serial.println(encodeJson(data).c_str());
+    Serial.flush();
+  }
+
+  void transmitReply(const std::string &line) override {
+    Serial.println(line.c_str());
+  }
+
+  void transmitEvent(const IMUEvent &event) override {
+    Serial.println(encodeEvent(event).c_str());
+  }
+
+  // a {"burst":{...}} header line then the samples in the STREAM_RAW CSV format
+  bool transmitBurst(BurstCapture &burst) override {
+    std::stringstream ss;
+    ss << "{\"burst\":{\"id\":" << (int)burst.id << ",\"us\":" << burst.triggerMicros;
+    ss << ",\"samples\":" << burst.count() << ",\"pre\":" << burst.preTriggerCount() << "}}";
+    Serial.println(ss.str().c_str());
+    for (size_t i = 0; i < burst.count(); i++) {
+      Serial.println(encodeRaw(burst.sample(i)).c_str());
+    }
+    Serial.flush();
+    return true;
+  }
+
+  void transmitDiagnostics(const IMUDiagnostics &diagnostics) override {
+    Serial.println(encodeDiagnostics(diagnostics).c_str());
   }
 };
\ No newline at end of file
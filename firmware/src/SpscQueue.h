@@ -0,0 +1,48 @@
+#pragma once
+
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+
+// Lock-free single-producer single-consumer ring buffer. One task pushes and
+// one task pops; neither ever blocks. N must be a power of two.
+template <typename T, size_t N>
+class SpscQueue {
+private:
+  static_assert((N & (N - 1)) == 0, "SpscQueue size must be a power of two");
+  T items[N];
+  // free-running counters - the difference is the number of queued items
+  std::atomic<uint32_t> head;
+  std::atomic<uint32_t> tail;
+
+public:
+  // items that didn't fit
+  std::atomic<uint32_t> dropped;
+
+  SpscQueue() : head(0), tail(0), dropped(0) {}
+
+  // producer only - returns false (and counts a drop) if the queue is full
+  bool push(const T &item) {
+    const uint32_t t = tail.load(std::memory_order_relaxed);
+    if (t - head.load(std::memory_order_acquire) >= N) {
+      dropped.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    }
+    items[t & (N - 1)] = item;
+    tail.store(t + 1, std::memory_order_release);
+    return true;
+  }
+
+  // consumer only
+  bool pop(T &item) {
+    const uint32_t h = head.load(std::memory_order_relaxed);
+    if (h == tail.load(std::memory_order_acquire)) return false;
+    item = items[h & (N - 1)];
+    head.store(h + 1, std::memory_order_release);
+    return true;
+  }
+
+  size_t size() const {
+    return tail.load(std::memory_order_acquire) - head.load(std::memory_order_acquire);
+  }
+};
@@ -0,0 +1,105 @@
+#pragma once
+
+#include <Arduino.h>
+#include <esp_timer.h>
+#include "SpscQueue.h"
+#include "IMUEvent.h"
+
+// edges waiting to be turned into events - must be a power of two
+#define SYNC_EDGE_QUEUE_SIZE 16
+
+// Shared timing marks for units recording together. Rising edges on the sync
+// input are timestamped in the GPIO interrupt with micros() - the same clock
+// the samples are stamped with - and end up in the stream as SYNC events, so
+// captures from several devices can be lined up afterwards. One unit can
+// drive the pulses itself from the sync output; its own edges are recorded
+// too (with id 1) so the master's capture carries the same marks.
+class SyncPulse {
+private:
+  struct Edge {
+    uint32_t timeMicros;
+    // edges seen since boot, this one included
+    uint32_t count;
+  };
+
+  int inputPin;
+  int outputPin;
+  // the interrupt / output timer push, the IMU loop pops
+  SpscQueue<Edge, SYNC_EDGE_QUEUE_SIZE> inputEdges;
+  SpscQueue<Edge, SYNC_EDGE_QUEUE_SIZE> outputEdges;
+  esp_timer_handle_t outputTimer = nullptr;
+  bool outputLevel = false;
+
+  static void IRAM_ATTR onInputEdge(void *arg) {
+    // timestamp first so queueing doesn't add to the latency
+    const uint32_t now = micros();
+    SyncPulse *sync = static_cast<SyncPulse *>(arg);
+    // counted here so edges the queue has no room for still count
+    const Edge edge = {now, ++sync->inputCount};
+    sync->inputEdges.push(edge);
+  }
+
+  // runs at twice the pulse frequency to make a square wave
+  static void onOutputTimer(void *arg) {
+    SyncPulse *sync = static_cast<SyncPulse *>(arg);
+    sync->outputLevel = !sync->outputLevel;
+    digitalWrite(sync->outputPin, sync->outputLevel ? HIGH : LOW);
+    if (sync->outputLevel) {
+      const Edge edge = {(uint32_t)micros(), ++sync->outputCount};
+      sync->outputEdges.push(edge);
+    }
+  }
+
+public:
+  // edges since boot - only written by the interrupt / output timer
+  volatile uint32_t inputCount = 0;
+  volatile uint32_t outputCount = 0;
+
+  // pass -1 for a pin that isn't wired up
+  SyncPulse(int inputPin, int outputPin) {
+    this->inputPin = inputPin;
+    this->outputPin = outputPin;
+  }
+
+  void begin() {
+    if (inputPin >= 0) {
+      pinMode(inputPin, INPUT_PULLDOWN);
+      attachInterruptArg(digitalPinToInterrupt(inputPin), onInputEdge, this, RISING);
+    }
+    if (outputPin >= 0) {
+      pinMode(outputPin, OUTPUT);
+      digitalWrite(outputPin, LOW);
+      esp_timer_create_args_t args = {};
+      args.callback = onOutputTimer;
+      args.arg = this;
+      args.name = "SyncOut";
+      esp_timer_create(&args, &outputTimer);
+    }
+  }
+
+  // start driving pulses on the sync output, 0 stops them
+  bool setOutputFrequency(float hz) {
+    if (!outputTimer) return false;
+    esp_timer_stop(outputTimer);
+    outputLevel = false;
+    digitalWrite(outputPin, LOW);
+    if (hz > 0.0f) {
+      esp_timer_start_periodic(outputTimer, (uint64_t)(500000.0f / hz));
+    }
+    return true;
+  }
+
+  // IMU loop - turns any new edges into SYNC events. The value is the edge
+  // count since boot from the interrupt, so an edge that was dropped because
+  // the queue was full shows up as a gap in the count.
+  template <typename F>
+  void drain(F publish) {
+    Edge edge;
+    while (inputEdges.pop(edge)) {
+      publish(IMUEvent::make(EVENT_SYNC, 0, edge.timeMicros, (float)edge.count));
+    }
+    while (outputEdges.pop(edge)) {
+      publish(IMUEvent::make(EVENT_SYNC, 1, edge.timeMicros, (float)edge.count));
+    }
+  }
+};
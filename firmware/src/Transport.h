@@ -1,58 +1,48 @@
 #pragma once
 
 #include <Arduino.h>
-#include <freertos/FreeRTOS.h>
 #include <functional>
 #include "IMUProcessor.h"
+#include "CommandProcessor.h"
+#include "SeqLock.h"
+#include "IMUEvent.h"
+#include "BurstCapture.h"
 
+// default send interval - we're aiming for around 100 updates per second -
+// way over the top!
+#define TRANSPORT_DEFAULT_INTERVAL_MS 10
+
+// An output for IMU data. Transports don't run their own tasks - the
+// TransportManager calls service() whenever this transport's deadline comes up.
 class Transport {
+  friend class TransportManager;
+
 protected:
   // should this be sending?
   bool active = false;
+  // snapshot being transmitted - only touched by the scheduler task
   IMUData data;
-  // dirty flag
-  bool dirty = false;
+  // sequence number of the last sample we transmitted
+  uint32_t lastSequence = 0;
+  // how often we want to send (ms) and when we're next due (millis)
+  uint32_t intervalMs;
+  uint32_t nextDeadline = 0;
   std::string name;
-  SemaphoreHandle_t dataLock;
-  using ResetGyroHandler = std::function<void()>;
-  ResetGyroHandler onResetGyro;
+  CommandProcessor *commands;
 
-  static void task(void *pvParameter) {
-    Transport *transport = static_cast<Transport *>(pvParameter);
-    while(true) {
-      if (!transport->active) {
-        vTaskDelay(100 / portTICK_PERIOD_MS);
-        continue;
-      }
-      uint32_t start = millis();
-      xSemaphoreTake(transport->dataLock, portMAX_DELAY);
-      if (transport->dirty) {
-        transport->dirty = false;
-        transport->transmit();
-      }
-      xSemaphoreGive(transport->dataLock);
-      int32_t elapsed = millis() - start;
-      int32_t requiredDelay = max(1, 10 - elapsed);
-      // we're aiming for around 100 updates per second - way over the top!
-      vTaskDelay(requiredDelay / portTICK_PERIOD_MS);
-    }
-  }
   public:
-    Transport(std::string name, ResetGyroHandler onResetGyro) {
-      this->onResetGyro = onResetGyro;
-      this->dataLock = xSemaphoreCreateMutex();
+    // samples sent - only written by the scheduler task
+    volatile uint32_t transmitted = 0;
+
+    Transport(std::string name, CommandProcessor *commands,
+              uint32_t intervalMs = TRANSPORT_DEFAULT_INTERVAL_MS) {
+      this->name = name;
+      this->commands = commands;
+      this->intervalMs = intervalMs;
     }
+    virtual ~Transport() {}
     virtual void begin() {
       active = true;
-      // Some weir dbehaviour here - if we don't pin to core 1, the serial output is corrupted
-      xTaskCreatePinnedToCore(
-        task,
-        name.c_str(),
-        8192,
-        this,
-        0,
-        nullptr,
-        1);
     }
     virtual void end() {
       active = false;
@@ -60,17 +50,41 @@ protected:
     virtual void setActive(bool active) {
       this->active = active;
     }
-    virtual void update(IMUData data) {
-      xSemaphoreTake(dataLock, portMAX_DELAY);
-      this->data = data;
-      this->dirty = true;
-      xSemaphoreGive(dataLock);
+    bool isActive() {
+      return active;
+    }
+    const std::string &getName() {
+      return name;
     }
 
-    void processCommand(std::string cmd) {
-      if (cmd == "RESET_GYRO") {
-        if (onResetGyro) onResetGyro();
+    // copy out the latest sample and send it if it's new - called from the
+    // scheduler task without holding any lock
+    void service(const SeqLock<IMUData> &latest) {
+      if (latest.readIfChanged(data, lastSequence)) {
+        transmit();
+        transmitted++;
       }
     }
+
+    // queued for the IMU loop to run
+    void processCommand(std::string cmd) {
+      if (commands) commands->post(cmd);
+    }
     virtual void transmit() = 0;
-};
\ No newline at end of file
+    // low rate diagnostics channel - transports that can't carry it ignore it
+    virtual void transmitDiagnostics(const IMUDiagnostics &) {}
+    // compact events (motion changes etc) - sent as soon as they're picked up
+    virtual void transmitEvent(const IMUEvent &) {}
+    // samples this transport queued but had to drop because it fell behind
+    virtual uint32_t droppedSamples() {
+      return 0;
+    }
+    // a command reply or other one-off line - sent even while the sample
+    // stream is off. Transports that can't carry text ignore it
+    virtual void transmitReply(const std::string &) {}
+    // a completed burst capture - it's only valid during the call. Returns
+    // false if this transport couldn't send it
+    virtual bool transmitBurst(BurstCapture &) {
+      return false;
+    }
+};
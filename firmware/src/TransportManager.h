@@ -0,0 +1,222 @@
+#pragma once
+
+#include <Arduino.h>
+#include <freertos/FreeRTOS.h>
+#include <algorithm>
+#include <vector>
+#include "Transport.h"
+#include "SeqLock.h"
+#include "SpscQueue.h"
+#include "IMUEvent.h"
+
+// how long to sleep when nothing is active (ms)
+#define TRANSPORT_IDLE_DELAY_MS 100
+// fastest the diagnostics channel will go - it's meant to be low rate
+#define DIAGNOSTICS_MIN_INTERVAL_MS 100
+// events waiting to be sent - must be a power of two
+#define TRANSPORT_EVENT_QUEUE_SIZE 32
+// command replies waiting to be sent
+#define TRANSPORT_REPLY_QUEUE_LENGTH 16
+
+// Owns the list of transports and drives all of them from a single task.
+// The IMU loop publishes each sample once with update(); the scheduler wakes
+// at the earliest transport deadline, services every transport that is due
+// and goes back to sleep - so adding an output costs a list entry rather than
+// another task stack and polling loop. It's also the only task that writes to
+// the transports, so a command reply can't land in the middle of a sample
+// line or a burst.
+class TransportManager {
+private:
+  std::vector<Transport *> transports;
+  // protects the list (not the data) so transports can be added at runtime
+  SemaphoreHandle_t listLock;
+  SeqLock<IMUData> latest;
+  bool running = false;
+  // events from the IMU loop, drained by the scheduler task
+  SpscQueue<IMUEvent, TRANSPORT_EVENT_QUEUE_SIZE> events;
+  // std::string * from any task - the scheduler task deletes them once sent
+  QueueHandle_t replies;
+  TaskHandle_t taskHandle = nullptr;
+  // sent and released once the IMU loop has filled it
+  BurstCapture *burst = nullptr;
+  // diagnostics channel - an interval of 0 means it's off
+  SeqLock<IMUDiagnostics> latestDiagnostics;
+  uint32_t diagnosticsSequence = 0;
+  volatile uint32_t diagnosticsIntervalMs = 0;
+  uint32_t nextDiagnosticsDeadline = 0;
+
+  void serviceDiagnostics(uint32_t now, uint32_t &sleepMs) {
+    const uint32_t intervalMs = diagnosticsIntervalMs;
+    if (intervalMs == 0) return;
+    if ((int32_t)(now - nextDiagnosticsDeadline) >= 0) {
+      nextDiagnosticsDeadline = now + intervalMs;
+      IMUDiagnostics diagnostics;
+      if (latestDiagnostics.readIfChanged(diagnostics, diagnosticsSequence)) {
+        for (Transport *transport : transports) {
+          if (transport->active) transport->transmitDiagnostics(diagnostics);
+        }
+      }
+    }
+    const int32_t untilDue = (int32_t)(nextDiagnosticsDeadline - millis());
+    if (untilDue < (int32_t)sleepMs) sleepMs = untilDue > 1 ? untilDue : 1;
+  }
+
+  // services anything that's due and returns how long we can sleep for
+  uint32_t runOnce() {
+    const uint32_t now = millis();
+    uint32_t sleepMs = TRANSPORT_IDLE_DELAY_MS;
+    xSemaphoreTake(listLock, portMAX_DELAY);
+    std::string *reply;
+    while (xQueueReceive(replies, &reply, 0) == pdTRUE) {
+      for (Transport *transport : transports) {
+        transport->transmitReply(*reply);
+      }
+      delete reply;
+    }
+    IMUEvent event;
+    while (events.pop(event)) {
+      for (Transport *transport : transports) {
+        if (transport->active) transport->transmitEvent(event);
+      }
+    }
+    if (burst && burst->ready()) {
+      bool sent = false;
+      for (Transport *transport : transports) {
+        if (transport->active && transport->transmitBurst(*burst)) sent = true;
+      }
+      if (sent) {
+        burstsSent++;
+      } else {
+        burstsDropped++;
+      }
+      burst->release();
+    }
+    for (Transport *transport : transports) {
+      if (!transport->active) continue;
+      if ((int32_t)(now - transport->nextDeadline) >= 0) {
+        transport->service(latest);
+        transport->nextDeadline += transport->intervalMs;
+        // if we fell behind (slow transmit or newly active) don't try to catch up
+        if ((int32_t)(millis() - transport->nextDeadline) >= 0) {
+          transport->nextDeadline = millis() + transport->intervalMs;
+        }
+      }
+      const int32_t untilDue = (int32_t)(transport->nextDeadline - millis());
+      if (untilDue < (int32_t)sleepMs) sleepMs = untilDue > 1 ? untilDue : 1;
+    }
+    serviceDiagnostics(now, sleepMs);
+    xSemaphoreGive(listLock);
+    return sleepMs;
+  }
+
+  static void task(void *pvParameter) {
+    TransportManager *manager = static_cast<TransportManager *>(pvParameter);
+    while (true) {
+      TickType_t ticks = manager->runOnce() / portTICK_PERIOD_MS;
+      // reply() wakes us early
+      ulTaskNotifyTake(pdTRUE, ticks > 0 ? ticks : 1);
+    }
+  }
+
+public:
+  // completed bursts, and ones no active transport could send - only written
+  // by the scheduler task
+  volatile uint32_t burstsSent = 0;
+  volatile uint32_t burstsDropped = 0;
+  // replies that didn't fit in the queue
+  volatile uint32_t repliesDropped = 0;
+
+  TransportManager() {
+    listLock = xSemaphoreCreateMutex();
+    replies = xQueueCreate(TRANSPORT_REPLY_QUEUE_LENGTH, sizeof(std::string *));
+  }
+
+  // begins the transport if the manager is already running
+  void add(Transport *transport) {
+    if (running) transport->begin();
+    xSemaphoreTake(listLock, portMAX_DELAY);
+    transport->nextDeadline = millis();
+    transports.push_back(transport);
+    xSemaphoreGive(listLock);
+  }
+
+  void remove(Transport *transport) {
+    xSemaphoreTake(listLock, portMAX_DELAY);
+    transports.erase(std::remove(transports.begin(), transports.end(), transport), transports.end());
+    xSemaphoreGive(listLock);
+    transport->end();
+  }
+
+  // begins every transport and starts the scheduler task
+  void begin() {
+    for (Transport *transport : transports) {
+      transport->begin();
+    }
+    running = true;
+    // Some weird behaviour here - if we don't pin to core 1, the serial output is corrupted
+    xTaskCreatePinnedToCore(
+      task,
+      "TransportManager",
+      8192,
+      this,
+      0,
+      &taskHandle,
+      1);
+  }
+
+  // called from the IMU loop - never blocks
+  void update(const IMUData &data) {
+    latest.write(data);
+  }
+
+  // any task - never blocks, drops the line if we're backed up
+  void reply(const std::string &line) {
+    std::string *copy = new std::string(line);
+    if (xQueueSend(replies, &copy, 0) != pdTRUE) {
+      delete copy;
+      repliesDropped++;
+      return;
+    }
+    if (taskHandle) xTaskNotifyGive(taskHandle);
+  }
+
+  // called from the IMU loop - never blocks, drops the event if we're backed up
+  void publishEvent(const IMUEvent &event) {
+    events.push(event);
+  }
+
+  // calls f with each transport while holding the list lock
+  template <typename F>
+  void forEach(F f) {
+    xSemaphoreTake(listLock, portMAX_DELAY);
+    for (Transport *transport : transports) {
+      f(transport);
+    }
+    xSemaphoreGive(listLock);
+  }
+
+  void setBurstCapture(BurstCapture *burst) {
+    this->burst = burst;
+  }
+
+  uint32_t droppedEvents() {
+    return events.dropped;
+  }
+
+  // 0 turns the diagnostics channel off
+  void setDiagnosticsInterval(uint32_t intervalMs) {
+    if (intervalMs > 0 && intervalMs < DIAGNOSTICS_MIN_INTERVAL_MS) {
+      intervalMs = DIAGNOSTICS_MIN_INTERVAL_MS;
+    }
+    diagnosticsIntervalMs = intervalMs;
+  }
+
+  bool diagnosticsEnabled() {
+    return diagnosticsIntervalMs > 0;
+  }
+
+  // called from the IMU loop when diagnostics are enabled - never blocks
+  void updateDiagnostics(const IMUDiagnostics &diagnostics) {
+    latestDiagnostics.write(diagnostics);
+  }
+};
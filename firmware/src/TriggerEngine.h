@@ -0,0 +1,229 @@
+#pragma once
+
+#include <Arduino.h>
+#include <freertos/FreeRTOS.h>
+#include <math.h>
+#include <sstream>
+#include <stddef.h>
+#include "CommandProcessor.h"
+#include "IMUFusion.h"
+#include "IMUEvent.h"
+#include "BurstCapture.h"
+
+#define TRIGGER_MAX_RULES 8
+
+enum TriggerKind : uint8_t {
+  TRIGGER_OFF,
+  // value goes above / below the threshold
+  TRIGGER_ABOVE,
+  TRIGGER_BELOW,
+  // magnitude of the rate of change goes above the threshold (units per s)
+  TRIGGER_RATE,
+};
+
+struct TriggerRule {
+  uint8_t id;
+  uint8_t channel;
+  TriggerKind kind;
+  float threshold;
+  // start a burst capture when it fires
+  bool burst;
+};
+
+// Threshold and rate-of-change rules on any IMUData channel, checked on every
+// sample. A rule fires once when its condition becomes true and re-arms when
+// it goes false again, so a value sitting over the limit gives one event not
+// a stream of them. Rules are changed with the TRIGGER command; changes are
+// queued and picked up by the IMU loop so it's the only thing touching the
+// rule state.
+class TriggerEngine {
+private:
+  struct Channel {
+    const char *name;
+    size_t offset;
+    // wraps at +/-180 so rates need unwrapping
+    bool angle;
+  };
+
+  static const Channel *channels(size_t &count) {
+    static const Channel table[] = {
+        {"AX", offsetof(IMUData, ax), false},
+        {"AY", offsetof(IMUData, ay), false},
+        {"AZ", offsetof(IMUData, az), false},
+        {"GX", offsetof(IMUData, gx), false},
+        {"GY", offsetof(IMUData, gy), false},
+        {"GZ", offsetof(IMUData, gz), false},
+        {"GYROROLL", offsetof(IMUData, accumulatedGyroX), true},
+        {"GYROPITCH", offsetof(IMUData, accumulatedGyroY), true},
+        {"GYROYAW", offsetof(IMUData, accumulatedGyroZ), true},
+        {"ROLL", offsetof(IMUData, fusionRoll), true},
+        {"PITCH", offsetof(IMUData, fusionPitch), true},
+        {"YAW", offsetof(IMUData, fusionYaw), true},
+        {"TEMP", offsetof(IMUData, temperatureC), false},
+    };
+    count = sizeof(table) / sizeof(table[0]);
+    return table;
+  }
+
+  static float channelValue(const IMUData &data, const Channel &channel) {
+    return *reinterpret_cast<const float *>(reinterpret_cast<const char *>(&data) + channel.offset);
+  }
+
+  static const char *kindName(TriggerKind kind) {
+    switch (kind) {
+    case TRIGGER_ABOVE:
+      return "ABOVE";
+    case TRIGGER_BELOW:
+      return "BELOW";
+    case TRIGGER_RATE:
+      return "RATE";
+    default:
+      return "OFF";
+    }
+  }
+
+  // owned by the IMU loop
+  TriggerRule rules[TRIGGER_MAX_RULES];
+  bool armed[TRIGGER_MAX_RULES];
+  float lastValue[TRIGGER_MAX_RULES];
+  uint32_t lastMicros[TRIGGER_MAX_RULES];
+  bool hasLast[TRIGGER_MAX_RULES];
+  uint8_t activeRules = 0;
+  // replies to TRIGGER go back through here
+  CommandProcessor *commands;
+  BurstCapture *burst;
+  // rule changes from the command handlers
+  QueueHandle_t pending;
+
+  void applyPending() {
+    TriggerRule rule;
+    bool changed = false;
+    while (xQueueReceive(pending, &rule, 0) == pdTRUE) {
+      rules[rule.id] = rule;
+      armed[rule.id] = true;
+      hasLast[rule.id] = false;
+      changed = true;
+    }
+    if (!changed) return;
+    activeRules = 0;
+    for (int i = 0; i < TRIGGER_MAX_RULES; i++) {
+      if (rules[i].kind != TRIGGER_OFF) activeRules++;
+    }
+  }
+
+  // TRIGGER <id> <channel> <ABOVE|BELOW|RATE> <threshold> [BURST], TRIGGER <id> OFF
+  // or just TRIGGER to list the rules
+  void handleCommand(const std::string &args) {
+    if (args.empty()) {
+      commands->reply(rulesJson());
+      return;
+    }
+    std::stringstream ss(args);
+    int id = -1;
+    std::string channelName, kindText;
+    float threshold = 0.0f;
+    ss >> id >> channelName;
+    if (id < 0 || id >= TRIGGER_MAX_RULES) {
+      commands->reply("{ \"error\": \"Trigger id must be 0-7\" }");
+      return;
+    }
+    TriggerRule rule;
+    rule.id = (uint8_t)id;
+    rule.channel = 0;
+    rule.kind = TRIGGER_OFF;
+    rule.threshold = 0.0f;
+    rule.burst = false;
+    if (channelName != "OFF") {
+      size_t count;
+      const Channel *table = channels(count);
+      while (rule.channel < count && channelName != table[rule.channel].name) rule.channel++;
+      ss >> kindText >> threshold;
+      if (kindText == "ABOVE") rule.kind = TRIGGER_ABOVE;
+      else if (kindText == "BELOW") rule.kind = TRIGGER_BELOW;
+      else if (kindText == "RATE") rule.kind = TRIGGER_RATE;
+      if (rule.channel >= count || rule.kind == TRIGGER_OFF || ss.fail()) {
+        commands->reply("{ \"error\": \"Usage: TRIGGER <id> <channel> <ABOVE|BELOW|RATE> <threshold> [BURST]\" }");
+        return;
+      }
+      std::string option;
+      ss >> option;
+      rule.burst = option == "BURST";
+      rule.threshold = threshold;
+    }
+    xQueueSend(pending, &rule, 0);
+  }
+
+public:
+  TriggerEngine(CommandProcessor *commands, BurstCapture *burst) {
+    this->commands = commands;
+    this->burst = burst;
+    for (int i = 0; i < TRIGGER_MAX_RULES; i++) {
+      rules[i].id = i;
+      rules[i].kind = TRIGGER_OFF;
+      armed[i] = true;
+      hasLast[i] = false;
+    }
+    pending = xQueueCreate(TRIGGER_MAX_RULES, sizeof(TriggerRule));
+    commands->registerCommand("TRIGGER", [this](const std::string &args) { handleCommand(args); });
+  }
+
+  // IMU loop - every sample. publish is called with each event raised.
+  template <typename F>
+  void evaluate(const IMUData &data, F publish) {
+    applyPending();
+    if (activeRules == 0) return;
+    size_t count;
+    const Channel *table = channels(count);
+    for (int i = 0; i < TRIGGER_MAX_RULES; i++) {
+      const TriggerRule &rule = rules[i];
+      if (rule.kind == TRIGGER_OFF) continue;
+      const Channel &channel = table[rule.channel];
+      const float value = channelValue(data, channel);
+      float measured = value;
+      bool condition;
+      if (rule.kind == TRIGGER_RATE) {
+        if (!hasLast[i] || data.timeMicros == lastMicros[i]) {
+          condition = false;
+        } else {
+          float change = value - lastValue[i];
+          if (channel.angle) change = remainderf(change, 360.0f);
+          measured = change * 1e6f / (data.timeMicros - lastMicros[i]);
+          condition = fabsf(measured) > rule.threshold;
+        }
+        lastValue[i] = value;
+        lastMicros[i] = data.timeMicros;
+        hasLast[i] = true;
+      } else {
+        condition = rule.kind == TRIGGER_ABOVE ? value > rule.threshold : value < rule.threshold;
+      }
+      if (!condition) {
+        armed[i] = true;
+        continue;
+      }
+      if (!armed[i]) continue;
+      armed[i] = false;
+      publish(IMUEvent::make(EVENT_TRIGGER, rule.id, data.timeMicros, measured));
+      if (rule.burst && burst) burst->trigger(rule.id, data.timeMicros);
+    }
+  }
+
+  // {"triggers":[{"id":0,"channel":"ROLL","kind":"ABOVE","threshold":45,"burst":false},...]}
+  std::string rulesJson() {
+    size_t count;
+    const Channel *table = channels(count);
+    std::stringstream ss;
+    ss << std::boolalpha << "{\"triggers\":[";
+    bool first = true;
+    for (int i = 0; i < TRIGGER_MAX_RULES; i++) {
+      const TriggerRule &rule = rules[i];
+      if (rule.kind == TRIGGER_OFF) continue;
+      if (!first) ss << ",";
+      first = false;
+      ss << "{\"id\":" << (int)rule.id << ",\"channel\":\"" << table[rule.channel].name;
+      ss << "\",\"kind\":\"" << kindName(rule.kind) << "\",\"threshold\":" << rule.threshold;
+      ss << ",\"burst\":" << rule.burst << "}";
+    }
+    ss << "]}";
+    return ss.str();
+  }
+};
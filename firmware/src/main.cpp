@@ -10,8 +10,17 @@
 
 #include "BluetoothTransport.h"
 #include "SerialTransport.h"
+#include "SerialCommandReader.h"
+#include "TransportManager.h"
+#include "TriggerEngine.h"
+#include "AllanCapture.h"
+#include "SyncPulse.h"
+#include "IMUSampler.h"
 #include "IMUProcessor.h"
+#include "PipelineStats.h"
 #include "StatusLeds.h"
+#include "CommandProcessor.h"
+#include "Bench.h"
 
 // Hardware constants
 #define I2C_SDA 7
@@ -19,6 +28,15 @@
 // LSM6DS3 I2C address - choose between 0x6A and 0x6B - most boards use 0x6A
 #define LSM6DS3_I2C_ADDR 0x6B
 
+// Starting full-scale ranges - the library defaults to the top ones (2000
+// dps, 16 g), which would leave the sampler nowhere to escalate to. Lower
+// ranges have finer resolution; a sensor that clips is stepped up from here.
+#define IMU_INITIAL_GYRO_RANGE 500 // deg/s: 125, 245, 500, 1000 or 2000
+#define IMU_INITIAL_ACCEL_RANGE 4  // g: 2, 4, 8 or 16
+// Gyro and accel output data rate - 1.66 kHz is the gyro's fastest and about
+// as much as the 400 kHz I2C bus can carry (see IMUSampler)
+#define IMU_SAMPLE_RATE 1660
+
 #define I2C_FREQUENCY_HZ 400000
 #define SERIAL_BAUD 460800
 
@@ -26,6 +44,11 @@
 #define PIN_BATT_CHARGING 16 // input, active-low: LOW = charging
 #define PIN_BATT_CHARGED 17  // input, active-low: LOW = charged
 
+// Sync pulses for aligning several units - comment out PIN_SYNC_IN if not
+// wired up, set PIN_SYNC_OUT to -1 if there's no output
+#define PIN_SYNC_IN 1   // input, rising edges are timestamped
+#define PIN_SYNC_OUT 2  // output, driven by SYNC_OUT on the master unit
+
 // Active-low LEDs
 #define PIN_LED_RED 4   // output, active-low: LOW = on
 #define PIN_LED_GREEN 6 // output, active-low: LOW = on
@@ -36,8 +59,17 @@ LSM6DS3 imu(I2C_MODE, LSM6DS3_I2C_ADDR);
 
 static SerialTransport *serialTransport = nullptr;
 static BluetoothTransport *bluetoothTransport = nullptr;
+static TransportManager *transports = nullptr;
+static IMUSampler *imuSampler = nullptr;
 static IMUProcessor *imuProcessor = nullptr;
+static PipelineStats *pipelineStats = nullptr;
 static StatusLeds *leds = nullptr;
+static CommandProcessor commands;
+static SerialCommandReader *serialCommands = nullptr;
+static BurstCapture *burstCapture = nullptr;
+static TriggerEngine *triggers = nullptr;
+static SyncPulse *syncPulse = nullptr;
+static AllanCapture *allanCapture = nullptr;
 
 void setup() {
   // USB serial
@@ -47,7 +79,10 @@ void setup() {
   Wire.begin(I2C_SDA, I2C_SCL, I2C_FREQUENCY_HZ);
 
   // Initialize sensor
-
+  imu.settings.gyroRange = IMU_INITIAL_GYRO_RANGE;
+  imu.settings.accelRange = IMU_INITIAL_ACCEL_RANGE;
+  imu.settings.gyroSampleRate = IMU_SAMPLE_RATE;
+  imu.settings.accelSampleRate = IMU_SAMPLE_RATE;
   if (imu.begin() != 0) {
     // Halt on failure
     while (true) {
@@ -67,15 +102,132 @@ void setup() {
   leds->begin();
   #endif
 
-  imuProcessor = new IMUProcessor(&imu);
-  auto resetGyro = []() {
+  // commands from every transport are run by loop(), between samples
+  commands.begin(xTaskGetCurrentTaskHandle());
+
+  // sampling runs on core 0, fusion and the transports on core 1
+  imuSampler = new IMUSampler(&imu);
+  imuProcessor = new IMUProcessor(imuSampler->getSampleRate());
+  commands.registerCommand("RESET_GYRO", [](const std::string &) {
     if (imuProcessor) imuProcessor->resetGyroIntegration();
-  };
-  serialTransport = new SerialTransport(resetGyro);
-  bluetoothTransport = new BluetoothTransport(resetGyro);
+  });
+  // forget the gyro bias and re-learn it quickly
+  commands.registerCommand("RESET_OFFSET", [](const std::string &) {
+    if (imuProcessor) imuProcessor->offset.reset();
+  });
+  // PREDICT [ms] - extrapolate the fused orientation ahead for display
+  // clients, 0 turns it off
+  commands.registerCommand("PREDICT", [](const std::string &args) {
+    if (!imuProcessor) return;
+    if (!args.empty()) imuProcessor->predictor.setHorizonMs(atof(args.c_str()));
+    std::stringstream ss;
+    ss << "{\"predict\":{\"ms\":" << imuProcessor->predictor.getHorizonMs() << "}}";
+    commands.reply(ss.str());
+  });
+  // AXES [alignment] - mounting orientation, e.g. AXES PXNZPY for +X-Z+Y
+  commands.registerCommand("AXES", [](const std::string &args) {
+    if (!args.empty()) {
+      FusionAxesAlignment alignment;
+      if (!AxesRemap::parse(args, alignment)) {
+        commands.reply("{ \"error\": \"Unknown axes alignment\" }");
+        return;
+      }
+      imuSampler->setAxesAlignment(alignment);
+    }
+    std::string reply = std::string("{\"axes\":\"") + AxesRemap::name(imuSampler->getAxesAlignment()) + "\"}";
+    commands.reply(reply);
+  });
+  // SATURATION [RESET] - per-axis clipping counters and current ranges
+  commands.registerCommand("SATURATION", [](const std::string &args) {
+    if (args == "RESET") imuSampler->resetSaturation();
+    commands.reply(imuSampler->saturationJson());
+  });
+  // BENCH [iterations] - cycles per call of the fusion kernels and encoders
+  commands.registerCommand("BENCH", [](const std::string &args) {
+    if (!Bench::start(&commands, atoi(args.c_str()))) {
+      commands.reply("{ \"error\": \"BENCH is already running\" }");
+    }
+  });
+  // DIAGNOSTICS [hz] - low rate AHRS/offset state, 0 turns it off
+  commands.registerCommand("DIAGNOSTICS", [](const std::string &args) {
+    const float hz = args.empty() ? 1.0f : atof(args.c_str());
+    if (transports) transports->setDiagnosticsInterval(hz > 0.0f ? (uint32_t)(1000.0f / hz) : 0);
+  });
+  serialTransport = new SerialTransport(&commands);
+  bluetoothTransport = new BluetoothTransport(&commands);
+
+  // serial commands are handled as they arrive, even while BLE is streaming
+  serialCommands = new SerialCommandReader(&commands);
+  serialCommands->begin();
+
+  #ifdef PIN_SYNC_IN
+  syncPulse = new SyncPulse(PIN_SYNC_IN, PIN_SYNC_OUT);
+  syncPulse->begin();
+  #endif
+  // SYNC_OUT <hz> - drive sync pulses from this unit, 0 stops them
+  commands.registerCommand("SYNC_OUT", [](const std::string &args) {
+    if (!syncPulse || !syncPulse->setOutputFrequency(atof(args.c_str()))) {
+      commands.reply("{ \"error\": \"No sync output pin\" }");
+    }
+  });
+
+  burstCapture = new BurstCapture();
+  triggers = new TriggerEngine(&commands, burstCapture);
 
-  serialTransport->begin();
-  bluetoothTransport->begin();
+  allanCapture = new AllanCapture();
+  serialTransport->setAllanCapture(allanCapture);
+  // ALLAN [hz|STOP] - stream every raw sample at a fixed output data rate
+  // with range escalation off, for noise characterisation (tools/allan_deviation)
+  commands.registerCommand("ALLAN", [](const std::string &args) {
+    std::stringstream ss;
+    if (args == "STOP") {
+      if (allanCapture->isRunning()) {
+        const uint32_t elapsed = micros() - allanCapture->startMicros;
+        allanCapture->stop();
+        imuSampler->setSampleRate(allanCapture->previousRate);
+        imuSampler->rangesLocked = false;
+        ss << "{\"allan\":{\"running\":false,\"samples\":" << allanCapture->recorded;
+        ss << ",\"dropped\":" << allanCapture->dropped() << ",\"seconds\":" << elapsed / 1e6f << "}}";
+        commands.reply(ss.str());
+      }
+      return;
+    }
+    // the samples only go out over serial, which is off while BLE is connected
+    if (!serialTransport->isActive()) {
+      commands.reply("{ \"error\": \"ALLAN needs the serial transport - disconnect BLE first\" }");
+      return;
+    }
+    const uint16_t rate = args.empty() ? ALLAN_DEFAULT_RATE : (uint16_t)atoi(args.c_str());
+    // a restart at another rate still goes back to the rate from before the first
+    const uint16_t previous = allanCapture->isRunning() ? allanCapture->previousRate : imuSampler->getSampleRate();
+    if (!imuSampler->setSampleRate(rate)) {
+      commands.reply("{ \"error\": \"Unsupported ALLAN rate\" }");
+      return;
+    }
+    imuSampler->rangesLocked = true;
+    ss << "{\"allan\":{\"running\":true,\"rate\":" << rate << ",\"gyroRange\":" << imu.settings.gyroRange;
+    ss << ",\"accelRange\":" << imu.settings.accelRange << "}}";
+    commands.reply(ss.str());
+    allanCapture->start(rate, previous, micros());
+  });
+
+  transports = new TransportManager();
+  // command replies go out from the transport task between samples
+  commands.setReplyHandler([](const std::string &line) { transports->reply(line); });
+  transports->setBurstCapture(burstCapture);
+  transports->add(serialTransport);
+  transports->add(bluetoothTransport);
+  transports->begin();
+
+  pipelineStats = new PipelineStats(imuSampler, imuProcessor, transports);
+  // PIPELINE [RESET] - per-stage sample rates, timings and drops
+  commands.registerCommand("PIPELINE", [](const std::string &args) {
+    if (args == "RESET") pipelineStats->reset();
+    commands.reply(pipelineStats->toJson());
+  });
+
+  // loop() is woken by the sampler as each sample is queued
+  imuSampler->begin(xTaskGetCurrentTaskHandle());
 }
 
 void loop() {
@@ -90,14 +242,29 @@ void loop() {
   // GREEN: solid when charged, off otherwise
   if (leds) leds->setGreenLed(isCharged ? StatusLeds::LED_STATE_ON : StatusLeds::LED_STATE_OFF);
   #endif
-  // Read in the values from the sensor
-  // First, handle any incoming Serial commands (non-blocking)
-  imuProcessor->update();
+  // Run everything the sampler has queued through fusion
+  IMUSample sample;
+  while (imuSampler->samples.pop(sample)) {
+    imuProcessor->update(sample);
+    allanCapture->record(sample);
+    serialTransport->record(sample);
 
-  IMUData snapshot = imuProcessor->getData();
+    IMUData snapshot = imuProcessor->getData();
 
-  serialTransport->update(snapshot);
-  bluetoothTransport->update(snapshot);
+    transports->update(snapshot);
+    burstCapture->record(snapshot);
+    triggers->evaluate(snapshot, [](const IMUEvent &event) { transports->publishEvent(event); });
+    if (imuProcessor->motionChanged) {
+      transports->publishEvent(IMUEvent::make(
+          imuProcessor->motion.moving ? EVENT_MOVING : EVENT_STATIONARY, 0,
+          snapshot.timeMicros, imuProcessor->motion.previousDuration));
+    }
+    if (transports->diagnosticsEnabled()) {
+      transports->updateDiagnostics(imuProcessor->getDiagnostics());
+    }
+  }
+  commands.runPending();
+  if (syncPulse) syncPulse->drain([](const IMUEvent &event) { transports->publishEvent(event); });
 
   // Update BLE combined characteristic and notify if connected
   if (bluetoothTransport->isConnected()) {
@@ -110,4 +277,8 @@ void loop() {
     // re-enable serial transport when not connected to BLE
     serialTransport->setActive(true);
   }
+
+  // sleep until the next sample - the timeout keeps the LEDs going if the
+  // sensor stops
+  ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(10));
 }
\ No newline at end of file
@@ -0,0 +1,144 @@
+// Web Worker that turns the serial byte stream and BLE packets into samples,
+// so line splitting and JSON.parse don't compete with the render loop. Samples
+// go into the shared SampleRing, or back to the page in batches if the page
+// isn't cross-origin isolated.
+
+import { SampleRing, SAMPLE_STRIDE, arrivalNow } from './sample-ring';
+import type { DecoderRequest, DecoderResponse } from './stream-decoder';
+
+const ctx = self as unknown as {
+    postMessage(message: DecoderResponse, transfer?: Transferable[]): void;
+    onmessage: ((event: MessageEvent<DecoderRequest>) => void) | null;
+};
+
+let ring: SampleRing | null = null;
+// samples waiting to be posted when there's no shared ring
+let batch: number[] = [];
+let batchArrivals: number[] = [];
+const sample = new Float32Array(SAMPLE_STRIDE);
+const textDecoder = new TextDecoder();
+let text = '';
+// lines still to come from a {"burst":...} block - they're earlier samples
+// sent again, so they're skipped like tools/Capture.h does
+let burstLines = 0;
+
+// arrival is stamped here rather than when the page draws the sample, so
+// the interpolator's offset and jitter estimates see the link and not the
+// frame rate
+function emit(values: Float32Array, offset: number, arrival: number) {
+    if (ring) {
+        ring.push(values, offset, arrival);
+    } else {
+        for (let i = 0; i < SAMPLE_STRIDE; i++) batch.push(values[offset + i]);
+        batchArrivals.push(arrival);
+    }
+}
+
+function flush() {
+    if (batch.length === 0) return;
+    const values = Float32Array.from(batch);
+    const arrivals = Float64Array.from(batchArrivals);
+    batch = [];
+    batchArrivals = [];
+    ctx.postMessage({ type: 'samples', values, arrivals }, [values.buffer as ArrayBuffer, arrivals.buffer as ArrayBuffer]);
+}
+
+// {"accel":{...},"gyro":{...},"temp":..,"fusion":{...},"gyroInt":{...},["predicted":{...},]"t":..}
+function decodeJson(line: string, arrival: number) {
+    let json;
+    try {
+        json = JSON.parse(line);
+    } catch {
+        return;
+    }
+    if (json.accel && json.gyro && json.gyroInt && json.fusion && typeof json.temp === 'number') {
+        sample[0] = json.accel.x;
+        sample[1] = json.accel.y;
+        sample[2] = json.accel.z;
+        sample[3] = json.gyro.x;
+        sample[4] = json.gyro.y;
+        sample[5] = json.gyro.z;
+        sample[6] = json.gyroInt.roll;
+        sample[7] = json.gyroInt.pitch;
+        sample[8] = json.gyroInt.yaw;
+        sample[9] = json.fusion.roll;
+        sample[10] = json.fusion.pitch;
+        sample[11] = json.fusion.yaw;
+        sample[12] = json.temp;
+        sample[13] = typeof json.t === 'number' ? json.t : NaN;
+        const predicted = json.predicted;
+        sample[14] = predicted ? predicted.roll : 0;
+        sample[15] = predicted ? predicted.pitch : 0;
+        sample[16] = predicted ? predicted.yaw : 0;
+        sample[17] = predicted ? predicted.ms : 0;
+        emit(sample, 0, arrival);
+    } else if (json.burst && typeof json.burst.samples === 'number') {
+        burstLines = json.burst.samples;
+    } else if (typeof json.error === 'string') {
+        ctx.postMessage({ type: 'deviceError', message: json.error });
+    }
+}
+
+function decodeSerial(chunk: Uint8Array) {
+    // a line finished by this chunk arrived now
+    const arrival = arrivalNow();
+    text += textDecoder.decode(chunk, { stream: true });
+    const lines = text.split('\n');
+    text = lines.pop() || '';
+    // STREAM_RAW samples are passed on for fusion in the browser
+    const rawLines: string[] = [];
+    for (const line of lines) {
+        const trimmed = line.trim();
+        if (!trimmed) continue;
+        if (burstLines > 0) {
+            burstLines--;
+            continue;
+        }
+        const c = trimmed.charCodeAt(0);
+        if (c === 123 /* { */) {
+            decodeJson(trimmed, arrival);
+        } else if (c >= 48 && c <= 57) {
+            rawLines.push(trimmed);
+        }
+    }
+    if (rawLines.length) ctx.postMessage({ type: 'rawLines', lines: rawLines, arrival });
+}
+
+// float32[18] little-endian, or float32[14] from older firmware
+function decodeBle(packet: ArrayBuffer) {
+    const arrival = arrivalNow();
+    const dv = new DataView(packet);
+    const count = Math.min(SAMPLE_STRIDE, Math.floor(dv.byteLength / 4));
+    if (count < 14) return;
+    sample.fill(0);
+    for (let i = 0; i < count; i++) sample[i] = dv.getFloat32(i * 4, true);
+    if (!isFinite(sample[13])) sample[13] = NaN;
+    emit(sample, 0, arrival);
+}
+
+ctx.onmessage = (event) => {
+    const message = event.data;
+    switch (message.type) {
+        case 'init':
+            ring = message.buffer ? new SampleRing(message.buffer) : null;
+            break;
+        case 'serial':
+            decodeSerial(message.chunk);
+            break;
+        case 'ble':
+            decodeBle(message.packet);
+            break;
+        case 'fused':
+            for (let i = 0; i < message.arrivals.length; i++) {
+                emit(message.values, i * SAMPLE_STRIDE, message.arrivals[i]);
+            }
+            break;
+        case 'reset':
+            // drop any partial line and multi-byte sequence from the last connection
+            textDecoder.decode();
+            text = '';
+            burstLines = 0;
+            break;
+    }
+    flush();
+};
@@ -0,0 +1,138 @@
+// Web Worker that runs the firmware's fusion pipeline (tools/fusion_wasm.cpp
+// compiled with Emscripten) over STREAM_RAW samples, so the device can send
+// raw data and the page still gets fused orientation without doing the maths
+// on the main thread.
+
+import type { FusionWorkerRequest, FusionWorkerResponse } from './host-fusion';
+
+// floats per sample in and out of fusion_process - see tools/fusion_wasm.cpp
+const INPUT_LENGTH = 7;
+const OUTPUT_LENGTH = 18;
+// smoothing of the sample interval estimate, and how far the measured rate can
+// be from the one fusion is set up for before it's changed
+const INTERVAL_ALPHA = 0.05;
+const RATE_TOLERANCE = 0.1;
+// longer gaps than this are lost samples or a restart, not the sample interval - us
+const MAX_INTERVAL_MICROS = 100000;
+
+interface FusionModule {
+    HEAPF32: Float32Array;
+    HEAPU32: Uint32Array;
+    _malloc(bytes: number): number;
+    _free(ptr: number): void;
+    _fusion_create(sampleRate: number): number;
+    _fusion_set_sample_rate(fusion: number, sampleRate: number): void;
+    _fusion_set_prediction_ms(fusion: number, ms: number): void;
+    _fusion_reset_gyro(fusion: number): void;
+    _fusion_reset_offset(fusion: number): void;
+    _fusion_process(fusion: number, timeMicros: number, samples: number, count: number, output: number): void;
+}
+
+const ctx = self as unknown as {
+    postMessage(message: FusionWorkerResponse, transfer?: Transferable[]): void;
+    onmessage: ((event: MessageEvent<FusionWorkerRequest>) => void) | null;
+};
+
+let module: FusionModule | null = null;
+let fusion = 0;
+// rate fusion is set up for - Hz, and the measured sample interval - us
+let sampleRate = 0;
+let interval = 0;
+let lastTime: number | null = null;
+// wasm heap buffers, grown as needed
+let capacity = 0;
+let timePtr = 0;
+let samplePtr = 0;
+let outputPtr = 0;
+
+function reserve(count: number) {
+    if (!module || count <= capacity) return;
+    if (capacity) {
+        module._free(timePtr);
+        module._free(samplePtr);
+        module._free(outputPtr);
+    }
+    capacity = Math.max(count, capacity * 2, 64);
+    timePtr = module._malloc(capacity * 4);
+    samplePtr = module._malloc(capacity * INPUT_LENGTH * 4);
+    outputPtr = module._malloc(capacity * OUTPUT_LENGTH * 4);
+}
+
+// keep the offset and recovery period (both counted in samples) in step with
+// the rate the device is actually sending at
+function trackRate(time: number) {
+    if (lastTime !== null) {
+        const dt = (time - lastTime) >>> 0;
+        if (dt > 0 && dt < MAX_INTERVAL_MICROS) {
+            interval = interval === 0 ? dt : interval + (dt - interval) * INTERVAL_ALPHA;
+        }
+    }
+    lastTime = time;
+    if (!module || interval === 0) return;
+    const measured = 1e6 / interval;
+    if (Math.abs(measured - sampleRate) > sampleRate * RATE_TOLERANCE) {
+        sampleRate = Math.round(measured);
+        module._fusion_set_sample_rate(fusion, sampleRate);
+    }
+}
+
+// time_us,gx,gy,gz,ax,ay,az,temp - anything else is skipped. arrivals[i] is
+// when lines[i] reached the decoder and goes back out with its sample
+function process(lines: string[], arrivals: number[]) {
+    if (!module) return;
+    reserve(lines.length);
+    // views have to be taken after any malloc - the heap may have grown
+    const times = module.HEAPU32.subarray(timePtr >> 2, (timePtr >> 2) + capacity);
+    const samples = module.HEAPF32.subarray(samplePtr >> 2, (samplePtr >> 2) + capacity * INPUT_LENGTH);
+    const sampleArrivals = new Float64Array(lines.length);
+    let count = 0;
+    for (let l = 0; l < lines.length; l++) {
+        const fields = lines[l].split(',');
+        if (fields.length < 8) continue;
+        const time = parseInt(fields[0], 10);
+        if (!isFinite(time)) continue;
+        times[count] = time >>> 0;
+        trackRate(times[count]);
+        for (let i = 0; i < INPUT_LENGTH; i++) {
+            samples[count * INPUT_LENGTH + i] = parseFloat(fields[i + 1]);
+        }
+        sampleArrivals[count] = arrivals[l];
+        count++;
+    }
+    if (count === 0) return;
+    module._fusion_process(fusion, timePtr, samplePtr, count, outputPtr);
+    const start = outputPtr >> 2;
+    const values = module.HEAPF32.slice(start, start + count * OUTPUT_LENGTH);
+    const valueArrivals = sampleArrivals.slice(0, count);
+    ctx.postMessage({ type: 'samples', count, values, arrivals: valueArrivals }, [values.buffer as ArrayBuffer, valueArrivals.buffer as ArrayBuffer]);
+}
+
+ctx.onmessage = async (event) => {
+    const message = event.data;
+    try {
+        switch (message.type) {
+            case 'init': {
+                const factory = (await import(/* @vite-ignore */ message.url)).default as () => Promise<FusionModule>;
+                module = await factory();
+                fusion = module._fusion_create(message.sampleRate);
+                sampleRate = message.sampleRate;
+                ctx.postMessage({ type: 'ready' });
+                break;
+            }
+            case 'lines':
+                process(message.lines, message.arrivals);
+                break;
+            case 'resetGyro':
+                if (module) module._fusion_reset_gyro(fusion);
+                break;
+            case 'resetOffset':
+                if (module) module._fusion_reset_offset(fusion);
+                break;
+            case 'setPrediction':
+                if (module) module._fusion_set_prediction_ms(fusion, message.ms);
+                break;
+        }
+    } catch (e) {
+        ctx.postMessage({ type: 'error', message: e instanceof Error ? e.message : String(e) });
+    }
+};
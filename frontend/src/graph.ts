@@ -29,9 +29,9 @@ export class AccelGraph {
   private autoscale: boolean;
   private autoscalePadding: number;
   private minSpan: number;
-  private seriesX: number[] = [];
-  private seriesY: number[] = [];
-  private seriesZ: number[] = [];
+  private series: SeriesBuffer[];
+  // points added since the last draw
+  private dirty = false;
 
   constructor(canvas: HTMLCanvasElement, options: AccelGraphOptions = {}) {
     this.canvas = canvas;
@@ -50,6 +50,7 @@ export class AccelGraph {
     this.autoscale = options.autoscale ?? false;
     this.autoscalePadding = Math.max(0, options.autoscalePadding ?? 0.1);
     this.minSpan = Math.max(0, options.minSpan ?? 0);
+    this.series = [0, 1, 2].map(() => new SeriesBuffer(this.historyLength));
 
     this.resize();
   }
@@ -70,25 +71,56 @@ export class AccelGraph {
   }
 
   addPoint(vector: DataVector) {
-    this.seriesX.push(vector.x);
-    this.seriesY.push(vector.y);
-    this.seriesZ.push(vector.z);
+    this.series[0].push(vector.x);
+    this.series[1].push(vector.y);
+    this.series[2].push(vector.z);
 
-    if (this.seriesX.length > this.historyLength) this.seriesX.shift();
-    if (this.seriesY.length > this.historyLength) this.seriesY.shift();
-    if (this.seriesZ.length > this.historyLength) this.seriesZ.shift();
+    this.dirty = true;
+  }
 
+  // redraw if points were added - call once per animation frame
+  render() {
+    if (!this.dirty) return;
     this.draw();
   }
 
   clear() {
-    this.seriesX = [];
-    this.seriesY = [];
-    this.seriesZ = [];
+    this.series.forEach((series) => series.clear());
     this.draw();
   }
 
+  // Calls fn with the x offset (CSS px from the left of the plot) and value
+  // range of each point to plot. Up to two samples per pixel they're plotted
+  // as is; beyond that each pixel column gets the min/max of its samples from
+  // the decimation pyramid, so the work depends on the width, not the history.
+  private forEachColumn(series: SeriesBuffer, innerWidth: number, fn: (x: number, min: number, max: number) => void) {
+    const count = series.count;
+    if (count === 0) return;
+    const first = series.written - count;
+    const sampleSpacing = innerWidth / Math.max(1, this.historyLength - 1);
+    const startX = Math.max(0, innerWidth - (count - 1) * sampleSpacing);
+    const samplesPerPixel = 1 / sampleSpacing;
+    if (samplesPerPixel <= 2) {
+      for (let i = 0; i < count; i++) {
+        const v = series.value(first + i);
+        fn(startX + i * sampleSpacing, v, v);
+      }
+      return;
+    }
+    const level = series.levelFor(samplesPerPixel / 2);
+    const columns = Math.ceil((count - 1) * sampleSpacing);
+    const range = { min: 0, max: 0 };
+    for (let c = 0; c <= columns; c++) {
+      const from = first + Math.floor(c * samplesPerPixel);
+      const to = Math.min(series.written, first + Math.floor((c + 1) * samplesPerPixel));
+      if (to <= from) continue;
+      series.range(level, from, to, range);
+      fn(startX + c, range.min, range.max);
+    }
+  }
+
   private draw() {
+    this.dirty = false;
     const ctx = this.ctx;
     const cssWidth = this.canvas.clientWidth || 300;
     const cssHeight = this.canvas.clientHeight || 120;
@@ -119,20 +151,18 @@ export class AccelGraph {
     }
 
     // Determine display range (fixed or autoscaled)
-    const seriesData = [this.seriesX, this.seriesY, this.seriesZ];
     const visibleCount = Math.max(1, Math.min(this.seriesLabels.length, 3));
+    const innerWidth = width - padLeft - padRight;
     let displayMin = this.minValue;
     let displayMax = this.maxValue;
     if (this.autoscale) {
       let dataMin = Number.POSITIVE_INFINITY;
       let dataMax = Number.NEGATIVE_INFINITY;
       for (let i = 0; i < visibleCount; i++) {
-        const arr = seriesData[i];
-        for (let j = 0; j < arr.length; j++) {
-          const v = arr[j];
-          if (v < dataMin) dataMin = v;
-          if (v > dataMax) dataMax = v;
-        }
+        this.forEachColumn(this.series[i], innerWidth, (_x, min, max) => {
+          if (min < dataMin) dataMin = min;
+          if (max > dataMax) dataMax = max;
+        });
       }
       if (dataMin === Number.POSITIVE_INFINITY || dataMax === Number.NEGATIVE_INFINITY) {
         // no data yet; keep configured range
@@ -199,19 +229,18 @@ export class AccelGraph {
     ctx.textBaseline = 'bottom';
     ctx.fillText(`${displayMin.toFixed(1)}${this.unitLabel}`, padLeft, height - 2);
 
-    const drawSeries = (data: number[], color: string) => {
-      if (data.length < 2) return;
-      const innerWidth = width - padLeft - padRight;
-      const sampleSpacing = innerWidth / Math.max(1, this.historyLength - 1);
-      const len = data.length;
-      const startX = padLeft + Math.max(0, innerWidth - (len - 1) * sampleSpacing);
+    const drawSeries = (series: SeriesBuffer, color: string) => {
+      if (series.count < 2) return;
       ctx.beginPath();
-      for (let i = 0; i < len; i++) {
-        const x = startX + i * sampleSpacing;
-        const y = valueToY(data[i]);
-        if (i === 0) ctx.moveTo(x, y);
-        else ctx.lineTo(x, y);
-      }
+      let first = true;
+      this.forEachColumn(series, innerWidth, (x, min, max) => {
+        const px = padLeft + x;
+        if (first) ctx.moveTo(px, valueToY(min));
+        else ctx.lineTo(px, valueToY(min));
+        first = false;
+        // decimated columns draw their full min/max span
+        if (max !== min) ctx.lineTo(px, valueToY(max));
+      });
       ctx.strokeStyle = color;
       ctx.lineWidth = 1.5;
       ctx.stroke();
@@ -219,7 +248,7 @@ export class AccelGraph {
 
     // Draw visible series
     for (let i = 0; i < visibleCount; i++) {
-      drawSeries(seriesData[i], this.seriesColors[i]);
+      drawSeries(this.series[i], this.seriesColors[i]);
     }
 
     // Legend (aligned to the right)
@@ -248,3 +277,90 @@ export class AccelGraph {
 }
 
 
+
+/**
+ * Fixed-length history of one channel: a Float32Array ring of the samples
+ * plus a min/max pyramid where level k holds the extremes of each aligned
+ * block of 2^k samples. Blocks are keyed by absolute sample index so pushing
+ * only touches the newest block of each level.
+ */
+class SeriesBuffer {
+  readonly capacity: number;
+  // samples ever pushed
+  written = 0;
+  private values: Float32Array;
+  // levels[k - 1] is level k
+  private levels: { min: Float32Array; max: Float32Array }[] = [];
+
+  constructor(capacity: number) {
+    this.capacity = Math.max(1, capacity);
+    this.values = new Float32Array(this.capacity);
+    for (let blockSize = 2; blockSize < this.capacity; blockSize *= 2) {
+      // enough blocks to cover the history however it's aligned
+      const blocks = Math.ceil(this.capacity / blockSize) + 1;
+      this.levels.push({ min: new Float32Array(blocks), max: new Float32Array(blocks) });
+    }
+  }
+
+  get count(): number {
+    return Math.min(this.written, this.capacity);
+  }
+
+  push(v: number) {
+    const index = this.written;
+    this.values[index % this.capacity] = v;
+    let blockSize = 2;
+    for (const level of this.levels) {
+      const slot = Math.floor(index / blockSize) % level.min.length;
+      if (index % blockSize === 0) {
+        level.min[slot] = v;
+        level.max[slot] = v;
+      } else {
+        if (v < level.min[slot]) level.min[slot] = v;
+        if (v > level.max[slot]) level.max[slot] = v;
+      }
+      blockSize *= 2;
+    }
+    this.written++;
+  }
+
+  clear() {
+    this.written = 0;
+  }
+
+  // sample by absolute index - must be within the last capacity samples
+  value(index: number): number {
+    return this.values[index % this.capacity];
+  }
+
+  // coarsest level whose blocks are no bigger than samples (0 = raw samples)
+  levelFor(samples: number): number {
+    let level = 0;
+    while (level < this.levels.length && 2 ** (level + 1) <= samples) level++;
+    return level;
+  }
+
+  // min/max of samples [from, to) - rounded out to whole blocks of the level
+  range(level: number, from: number, to: number, out: { min: number; max: number }) {
+    let min = Number.POSITIVE_INFINITY;
+    let max = Number.NEGATIVE_INFINITY;
+    if (level === 0) {
+      for (let i = from; i < to; i++) {
+        const v = this.values[i % this.capacity];
+        if (v < min) min = v;
+        if (v > max) max = v;
+      }
+    } else {
+      const blockSize = 2 ** level;
+      const { min: mins, max: maxes } = this.levels[level - 1];
+      const last = Math.floor((to - 1) / blockSize);
+      for (let block = Math.floor(from / blockSize); block <= last; block++) {
+        const slot = block % mins.length;
+        if (mins[slot] < min) min = mins[slot];
+        if (maxes[slot] > max) max = maxes[slot];
+      }
+    }
+    out.min = min;
+    out.max = max;
+  }
+}
@@ -0,0 +1,130 @@
+// Messages to and from fusion-worker.ts
+export type FusionWorkerRequest =
+    | { type: 'init'; url: string; sampleRate: number }
+    | { type: 'lines'; lines: string[]; arrivals: number[] }
+    | { type: 'resetGyro' }
+    | { type: 'resetOffset' }
+    | { type: 'setPrediction'; ms: number };
+
+export type FusionWorkerResponse =
+    | { type: 'ready' }
+    | { type: 'error'; message: string }
+    | { type: 'samples'; count: number; values: Float32Array; arrivals: Float64Array };
+
+// Emscripten output from tools/ (see tools/README.md), served from public/
+const FUSION_WASM_URL = '/wasm/fusion.js';
+// STREAM_RAW sends every sample, at the sensor's output data rate. This is the
+// firmware's default; the worker follows the rate the timestamps show if the
+// device runs at another one (e.g. during ALLAN)
+const HOST_FUSION_SAMPLE_RATE = 1660;
+
+interface HostFusionEvents {
+    // fused samples in the SampleRing layout and when their raw lines arrived
+    samples: (values: Float32Array, arrivals: Float64Array) => void;
+    error: (error: Error) => void;
+}
+
+// Fuses raw samples in a Web Worker running the firmware's IMUFusion compiled
+// to WebAssembly. Feed it STREAM_RAW lines; it emits the same samples the
+// device would have sent.
+export class HostFusion {
+    private worker: Worker | null = null;
+    private pending: string[] = [];
+    private pendingArrivals: number[] = [];
+    private flushScheduled = false;
+    private eventListeners: { [K in keyof HostFusionEvents]?: HostFusionEvents[K][] } = {};
+
+    get isRunning(): boolean {
+        return this.worker !== null;
+    }
+
+    on<K extends keyof HostFusionEvents>(event: K, callback: HostFusionEvents[K]) {
+        if (!this.eventListeners[event]) {
+            this.eventListeners[event] = [];
+        }
+        this.eventListeners[event]!.push(callback);
+    }
+
+    private emit<K extends keyof HostFusionEvents>(event: K, ...args: Parameters<HostFusionEvents[K]>) {
+        this.eventListeners[event]?.forEach(callback => {
+            (callback as (...args: Parameters<HostFusionEvents[K]>) => void)(...args);
+        });
+    }
+
+    // resolves once the wasm module has loaded in the worker
+    start(): Promise<void> {
+        if (this.worker) return Promise.resolve();
+        const worker = new Worker(new URL('./fusion-worker.ts', import.meta.url), { type: 'module' });
+        this.worker = worker;
+        return new Promise((resolve, reject) => {
+            let ready = false;
+            worker.onmessage = (event: MessageEvent<FusionWorkerResponse>) => {
+                const message = event.data;
+                if (message.type === 'ready') {
+                    ready = true;
+                    resolve();
+                } else if (message.type === 'error') {
+                    const error = new Error(`Host fusion: ${message.message}`);
+                    if (!ready) {
+                        this.stop();
+                        reject(error);
+                    } else {
+                        this.emit('error', error);
+                    }
+                } else if (message.type === 'samples') {
+                    this.emit('samples', message.values, message.arrivals);
+                }
+            };
+            worker.onerror = (event) => {
+                const error = new Error(`Host fusion: ${event.message}`);
+                if (!ready) {
+                    this.stop();
+                    reject(error);
+                } else {
+                    this.emit('error', error);
+                }
+            };
+            this.post({ type: 'init', url: new URL(FUSION_WASM_URL, location.href).href, sampleRate: HOST_FUSION_SAMPLE_RATE });
+        });
+    }
+
+    stop() {
+        this.worker?.terminate();
+        this.worker = null;
+        this.pending = [];
+        this.pendingArrivals = [];
+    }
+
+    // queue STREAM_RAW lines that arrived at the same time (see arrivalNow() in
+    // sample-ring.ts) - they're sent to the worker in batches
+    pushLines(lines: string[], arrival: number) {
+        if (!this.worker) return;
+        this.pending.push(...lines);
+        for (let i = 0; i < lines.length; i++) this.pendingArrivals.push(arrival);
+        if (this.flushScheduled) return;
+        this.flushScheduled = true;
+        queueMicrotask(() => {
+            this.flushScheduled = false;
+            if (this.pending.length === 0) return;
+            this.post({ type: 'lines', lines: this.pending, arrivals: this.pendingArrivals });
+            this.pending = [];
+            this.pendingArrivals = [];
+        });
+    }
+
+    resetGyro() {
+        this.post({ type: 'resetGyro' });
+    }
+
+    resetOffset() {
+        this.post({ type: 'resetOffset' });
+    }
+
+    setPredictionMs(ms: number) {
+        this.post({ type: 'setPrediction', ms });
+    }
+
+    private post(message: FusionWorkerRequest) {
+        this.worker?.postMessage(message);
+    }
+}
@@ -4,6 +4,8 @@ import { WebBLEManager } from './webble';
 import { SceneManager } from './scene';
 import { PCBModel } from './pcb-model';
 import { AccelGraph } from './graph';
+import { HostFusion } from './host-fusion';
+import { StreamDecoder } from './stream-decoder';
 
 class AccelerometerApp {
     private serialManager: WebSerialManager;
@@ -40,9 +42,16 @@ class AccelerometerApp {
     private msgRateEl!: HTMLElement;
     private msgTimestamps: number[] = [];
     private deviceErrorEl!: HTMLElement
+    // fusion of the raw serial stream in a worker, instead of on the device
+    private hostFusion = new HostFusion();
+    // decodes both transports in a worker; drained once per frame
+    private decoder = new StreamDecoder();
+    // newest sample drained this frame, for the text readouts
+    private latestData: SensorData | null = null;
+    private hostFusionToggle!: HTMLInputElement;
 
     constructor() {
-        this.serialManager = new WebSerialManager();
+        this.serialManager = new WebSerialManager(this.decoder);
         this.sceneManager = new SceneManager();
         
         this.connectBtn = document.getElementById('connect-btn') as HTMLButtonElement;
@@ -135,6 +144,13 @@ class AccelerometerApp {
         this.modelFileInput.addEventListener('change', (e) => this.handleModelFileChange(e));
         this.modelFileButton.addEventListener('click', () => this.modelFileInput.click());
 
+        this.hostFusionToggle = document.getElementById('host-fusion-toggle') as HTMLInputElement;
+        if (this.hostFusionToggle) {
+            this.hostFusionToggle.addEventListener('change', () => void this.setHostFusion(this.hostFusionToggle.checked));
+        }
+        this.hostFusion.on('samples', (values: Float32Array, arrivals: Float64Array) => this.decoder.pushFused(values, arrivals));
+        this.hostFusion.on('error', (error: Error) => this.showDeviceError(error.message));
+
         // Mode radio buttons
         this.modeAccelRadio = document.getElementById('mode-accel') as HTMLInputElement;
         this.modeGyroRadio = document.getElementById('mode-gyro') as HTMLInputElement;
@@ -145,6 +161,7 @@ class AccelerometerApp {
             this.modeAccelRadio.addEventListener('change', () => {
                 if (this.modeAccelRadio.checked) {
                     this.mode = 'accel';
+                    this.pcbModel?.resetInterpolation();
                     // Enable smoothing UI in accel mode
                     this.smoothingSlider.disabled = false;
                     if (this.smoothingGroupEl) this.smoothingGroupEl.style.opacity = '1';
@@ -156,6 +173,7 @@ class AccelerometerApp {
             this.modeGyroRadio.addEventListener('change', () => {
                 if (this.modeGyroRadio.checked) {
                     this.mode = 'gyro';
+                    this.pcbModel?.resetInterpolation();
                     // Reset timing so first dt is not huge
                     this.prevDeviceTimeSec = null;
                     // Disable smoothing UI in gyro mode
@@ -169,6 +187,7 @@ class AccelerometerApp {
             this.modeFusionRadio.addEventListener('change', () => {
                 if (this.modeFusionRadio.checked) {
                     this.mode = 'fusion';
+                    this.pcbModel?.resetInterpolation();
                     // Disable smoothing UI in fusion mode (handled by AHRS)
                     this.smoothingSlider.disabled = true;
                     if (this.smoothingGroupEl) this.smoothingGroupEl.style.opacity = '0.5';
@@ -198,6 +217,9 @@ class AccelerometerApp {
                     if (this.serialManager.isConnected) {
                         await this.serialManager.sendCommand('RESET_GYRO');
                     }
+                    if (this.hostFusion.isRunning) {
+                        this.hostFusion.resetGyro();
+                    }
                     if (this.bleManager && this.bleManager.isConnected) {
                         await this.bleManager.sendCommand('RESET_GYRO');
                     }
@@ -220,7 +242,7 @@ class AccelerometerApp {
             }
             // Reset timing so first dt is sane
             this.prevDeviceTimeSec = null;
-            
+            if (this.hostFusionToggle?.checked) void this.setHostFusion(true);
         });
         
         this.serialManager.on('disconnected', () => {
@@ -242,21 +264,13 @@ class AccelerometerApp {
             this.tempGraph.clear();
             // Avoid large integration step on next connect
             this.prevDeviceTimeSec = null;
+            this.pcbModel?.resetInterpolation();
+            this.hostFusion.stop();
         });
         
-        this.serialManager.on('data', (data: SensorData) => {
-            this.handleSensorData(data);
-        });
-        this.serialManager.on('rawLine', () => {
-            // ignore raw lines
-        });
-        this.serialManager.on('deviceError', (message: string) => {
-            if (this.deviceErrorEl) {
-                this.deviceErrorEl.textContent = `Device error: ${message}`;
-                this.deviceErrorEl.style.display = 'block';
-                this.deviceErrorEl.className = 'status disconnected';
-            }
-        });
+        // STREAM_RAW samples, when the browser is doing the fusion
+        this.decoder.on('rawLines', (lines: string[], arrival: number) => this.hostFusion.pushLines(lines, arrival));
+        this.decoder.on('deviceError', (message: string) => this.showDeviceError(message));
         
         this.serialManager.on('error', (error: Error) => {
             console.error('Serial error:', error);
@@ -265,6 +279,33 @@ class AccelerometerApp {
         });
     }
 
+    private showDeviceError(message: string) {
+        if (this.deviceErrorEl) {
+            this.deviceErrorEl.textContent = `Device error: ${message}`;
+            this.deviceErrorEl.style.display = 'block';
+            this.deviceErrorEl.className = 'status disconnected';
+        }
+    }
+
+    // switch the serial stream between device fusion (JSON) and raw samples
+    // fused in the browser
+    private async setHostFusion(enabled: boolean) {
+        if (enabled) {
+            try {
+                await this.hostFusion.start();
+            } catch (e) {
+                this.showDeviceError(e instanceof Error ? e.message : String(e));
+                this.hostFusionToggle.checked = false;
+                return;
+            }
+            this.prevDeviceTimeSec = null;
+            if (this.serialManager.isConnected) await this.serialManager.sendCommand('STREAM_RAW');
+        } else {
+            this.hostFusion.stop();
+            if (this.serialManager.isConnected) await this.serialManager.sendCommand('STREAM_JSON');
+        }
+    }
+
     private setupBLEIfAvailable() {
         const btn = document.getElementById('connect-ble-btn') as HTMLButtonElement | null;
         if (!btn) return;
@@ -274,7 +315,7 @@ class AccelerometerApp {
             this.connectBLEBtn.textContent = 'WebBLE not supported';
             return;
         }
-        this.bleManager = new WebBLEManager();
+        this.bleManager = new WebBLEManager(this.decoder);
         this.connectBLEBtn.addEventListener('click', () => this.handleBLEConnect());
         this.bleManager.on('connected', () => {
             this.statusEl.textContent = 'Connected (BLE)';
@@ -300,8 +341,8 @@ class AccelerometerApp {
             this.gyroIntGraph.clear();
             this.tempGraph.clear();
             this.prevDeviceTimeSec = null;
+            this.pcbModel?.resetInterpolation();
         });
-        this.bleManager.on('data', (data: SensorData) => this.handleSensorData(data));
         this.bleManager.on('error', (error: Error) => {
             console.error('BLE error:', error);
             this.statusEl.textContent = `Error: ${error.message}`;
@@ -364,6 +405,7 @@ class AccelerometerApp {
 
     
 
+    // every decoded sample - feeds the model and graphs
     private handleSensorData(data: SensorData) {
         // Update message rate using a 1s sliding window based on device time
         const nowSec = isFinite(data.t) ? data.t : (this.msgTimestamps.length ? this.msgTimestamps[this.msgTimestamps.length - 1] : 0);
@@ -373,21 +415,7 @@ class AccelerometerApp {
         while (this.msgTimestamps.length && this.msgTimestamps[0] < oneSecondAgo) {
             this.msgTimestamps.shift();
         }
-        if (this.msgRateEl) {
-            this.msgRateEl.textContent = `Msgs/s: ${this.msgTimestamps.length.toString()}`;
-        }
 
-        // Update UI elements
-        document.getElementById('accel-x')!.textContent = data.accel.x.toFixed(3);
-        document.getElementById('accel-y')!.textContent = data.accel.y.toFixed(3);
-        document.getElementById('accel-z')!.textContent = data.accel.z.toFixed(3);
-        
-        document.getElementById('gyro-x')!.textContent = data.gyro.x.toFixed(2);
-        document.getElementById('gyro-y')!.textContent = data.gyro.y.toFixed(2);
-        document.getElementById('gyro-z')!.textContent = data.gyro.z.toFixed(2);
-        
-        document.getElementById('temperature')!.textContent = data.temperature.toFixed(1);
-        
         // Update 3D model orientation based on selected mode
         if (this.pcbModel) {
             // Compute dt strictly from device absolute time
@@ -397,51 +425,74 @@ class AccelerometerApp {
             if (this.mode === 'accel') {
                 this.pcbModel.updateOrientationFromAccel(data.accel, dt);
             } else if (this.mode === 'gyro') {
-                this.pcbModel.updateOrientationFromEuler(data.gyroInt, dt);
+                this.pcbModel.updateOrientationFromEuler(data.gyroInt, data.t, data.arrival);
             } else if (this.mode === 'fusion') {
-                if (data.fusion) {
-                    this.pcbModel.updateOrientationFromEuler(data.fusion, dt);
+                // show where the device will be once this frame is on screen
+                // if the firmware is predicting, the graphs keep the measured angles
+                const orientation = data.predicted ?? data.fusion;
+                if (orientation) {
+                    this.pcbModel.updateOrientationFromEuler(orientation, data.t, data.arrival);
                 }
             }
         }
 
-        // Feed graphs
+        // Feed graphs - they redraw once per frame
         this.accelGraph.addPoint(data.accel);
         this.gyroGraph.addPoint(data.gyro);
         // Always integrate gyro for a separate display regardless of mode
+        if (data.gyroInt) {
+            this.gyroIntGraph.addPoint({
+                x: this.normalize180(data.gyroInt.roll),
+                y: this.normalize180(data.gyroInt.pitch),
+                z: this.normalize180(data.gyroInt.yaw),
+            });
+        }
+        this.tempGraph.addPoint({ x: data.temperature, y: 0, z: 0 });
+        if (data.fusion) {
+            // Graph expects values within [-180, 180); normalize so X/Z are not pegged at range limits
+            this.fusionGraph?.addPoint({
+                x: this.normalize180(data.fusion.roll),
+                y: this.normalize180(data.fusion.pitch),
+                z: this.normalize180(data.fusion.yaw),
+            });
+        }
+        this.latestData = data;
+    }
+
+    // text readouts only need the newest sample, once per frame
+    private updateReadouts(data: SensorData) {
+        if (this.msgRateEl) {
+            this.msgRateEl.textContent = `Msgs/s: ${this.msgTimestamps.length.toString()}`;
+        }
+
+        document.getElementById('accel-x')!.textContent = data.accel.x.toFixed(3);
+        document.getElementById('accel-y')!.textContent = data.accel.y.toFixed(3);
+        document.getElementById('accel-z')!.textContent = data.accel.z.toFixed(3);
+
+        document.getElementById('gyro-x')!.textContent = data.gyro.x.toFixed(2);
+        document.getElementById('gyro-y')!.textContent = data.gyro.y.toFixed(2);
+        document.getElementById('gyro-z')!.textContent = data.gyro.z.toFixed(2);
+
         if (data.gyroInt) {
             const r = document.getElementById('gyro-int-roll');
             const p = document.getElementById('gyro-int-pitch');
             const y = document.getElementById('gyro-int-yaw');
-            const ir = this.normalize180(data.gyroInt.roll);
-            const ip = this.normalize180(data.gyroInt.pitch);
-            const iy = this.normalize180(data.gyroInt.yaw);
             if (r && p && y) {
-                r.textContent = ir.toFixed(1);
-                p.textContent = ip.toFixed(1);
-                y.textContent = iy.toFixed(1);
+                r.textContent = this.normalize180(data.gyroInt.roll).toFixed(1);
+                p.textContent = this.normalize180(data.gyroInt.pitch).toFixed(1);
+                y.textContent = this.normalize180(data.gyroInt.yaw).toFixed(1);
             }
-            this.gyroIntGraph.addPoint({ x: ir, y: ip, z: iy });
         }
         // Temperature (raw)
         document.getElementById('temperature')!.textContent = data.temperature.toFixed(1);
-        this.tempGraph.addPoint({ x: data.temperature, y: 0, z: 0 });
         if (data.fusion) {
-            const r = data.fusion.roll;
-            const p = data.fusion.pitch;
-            const y = data.fusion.yaw;
-            // Graph expects values within [-180, 180); normalize so X/Z are not pegged at range limits
-            const gr = this.normalize180(r);
-            const gp = this.normalize180(p);
-            const gy = this.normalize180(y);
-            this.fusionGraph?.addPoint({ x: gr, y: gp, z: gy });
             const fr = document.getElementById('fusion-roll');
             const fp = document.getElementById('fusion-pitch');
             const fy = document.getElementById('fusion-yaw');
             if (fr && fp && fy) {
-                fr.textContent = gr.toFixed(1);
-                fp.textContent = gp.toFixed(1);
-                fy.textContent = gy.toFixed(1);
+                fr.textContent = this.normalize180(data.fusion.roll).toFixed(1);
+                fp.textContent = this.normalize180(data.fusion.pitch).toFixed(1);
+                fy.textContent = this.normalize180(data.fusion.yaw).toFixed(1);
             }
         }
     }
@@ -453,6 +504,18 @@ class AccelerometerApp {
 
     private animate() {
         requestAnimationFrame(() => this.animate());
+        // everything the decode worker produced since the last frame
+        const count = this.decoder.drain((data) => this.handleSensorData(data));
+        if (count > 0 && this.latestData) {
+            this.updateReadouts(this.latestData);
+            this.accelGraph.render();
+            this.gyroGraph.render();
+            this.fusionGraph.render();
+            this.gyroIntGraph.render();
+            this.tempGraph.render();
+        }
+        // smooth playback of the gyro/fusion orientation between samples
+        if (this.mode !== 'accel') this.pcbModel?.updateInterpolated();
         this.sceneManager.render();
     }
 }
@@ -0,0 +1,83 @@
+import * as THREE from 'three';
+
+// bounds on how far behind the newest sample we render (seconds)
+const MIN_DELAY = 0.01;
+const MAX_DELAY = 0.2;
+// how fast the clock offset estimate may creep later, to follow clock drift
+// and recover from one unusually early packet (seconds per second)
+const OFFSET_CREEP = 0.002;
+// smoothing of the interval and jitter estimates
+const ESTIMATE_ALPHA = 0.05;
+
+/**
+ * Buffers timestamped orientations and plays them back at display refresh
+ * rate. Device timestamps are mapped onto the local clock using the smallest
+ * arrival delay seen (the packets that got through fastest), and rendering
+ * runs a little behind that - about one sample interval plus the measured
+ * jitter - so there is nearly always a sample either side of the render
+ * instant to SLERP between. Link jitter then shows up as a fixed small delay
+ * rather than as stutter.
+ */
+export class OrientationInterpolator {
+    private samples: { t: number; q: THREE.Quaternion }[] = [];
+    // local time minus device time for the fastest packets - seconds
+    private offset: number | null = null;
+    private lastArrival = 0;
+    // smoothed sample interval and arrival jitter - seconds
+    private interval = 0.01;
+    private jitter = 0;
+
+    reset() {
+        this.samples = [];
+        this.offset = null;
+        this.jitter = 0;
+    }
+
+    // q is copied; deviceTime and localTime are in seconds
+    push(q: THREE.Quaternion, deviceTime: number, localTime: number) {
+        let newest: { t: number } | undefined = this.samples[this.samples.length - 1];
+        if (newest && deviceTime <= newest.t) {
+            if (deviceTime >= newest.t - 1) return;
+            // device rebooted or reconnected - start again
+            this.reset();
+            newest = undefined;
+        }
+        if (newest) {
+            const dt = deviceTime - newest.t;
+            this.interval += (dt - this.interval) * ESTIMATE_ALPHA;
+        }
+        const offset = localTime - deviceTime;
+        if (this.offset === null) {
+            this.offset = offset;
+        } else {
+            this.offset = Math.min(this.offset + OFFSET_CREEP * Math.max(0, localTime - this.lastArrival), offset);
+            this.jitter += (offset - this.offset - this.jitter) * ESTIMATE_ALPHA;
+        }
+        this.lastArrival = localTime;
+        this.samples.push({ t: deviceTime, q: q.clone() });
+    }
+
+    // playout delay behind the fastest path - seconds
+    get delay(): number {
+        return Math.min(MAX_DELAY, Math.max(MIN_DELAY, this.interval + 2 * this.jitter));
+    }
+
+    // orientation to show at localTime (seconds); false if there's nothing yet
+    sample(localTime: number, out: THREE.Quaternion): boolean {
+        if (this.offset === null || this.samples.length === 0) return false;
+        const t = localTime - this.offset - this.delay;
+        // drop everything before the pair we're between
+        while (this.samples.length > 2 && this.samples[1].t <= t) this.samples.shift();
+        const a = this.samples[0];
+        const b = this.samples[1];
+        if (!b || t <= a.t) {
+            out.copy(t <= a.t ? a.q : this.samples[this.samples.length - 1].q);
+        } else if (t >= b.t) {
+            // ran out of samples - hold the newest
+            out.copy(b.q);
+        } else {
+            out.slerpQuaternions(a.q, b.q, (t - a.t) / (b.t - a.t));
+        }
+        return true;
+    }
+}
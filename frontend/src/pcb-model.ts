@@ -1,5 +1,6 @@
 import * as THREE from 'three';
 import { GLTFLoader } from 'three/examples/jsm/loaders/GLTFLoader.js';
+import { OrientationInterpolator } from './orientation-interpolator';
 
 export class PCBModel {
     private scene: THREE.Scene;
@@ -10,6 +11,8 @@ export class PCBModel {
     // Fixed basis transform mapping sensor frame (Xs, Ys, Zs) to Three.js model frame (Xm, Ym, Zm)
     // Mapping used throughout: Xm = Xs, Ym = Zs, Zm = -Ys  => rotation Rx(-90°)
     private sensorToModel = new THREE.Quaternion().setFromAxisAngle(new THREE.Vector3(1, 0, 0), -Math.PI / 2);
+    // Euler updates are buffered and SLERPed to the display refresh instant
+    private interpolator = new OrientationInterpolator();
 
     constructor(scene: THREE.Scene) {
         this.scene = scene;
@@ -230,8 +233,11 @@ export class PCBModel {
         this.applyRotationToModel();
     }
 
-    // Update from Euler angles (degrees)
-    updateOrientationFromEuler(eulerDeg: { roll: number; pitch: number; yaw: number }, _dtSeconds: number) {
+    // Update from Euler angles (degrees) at device time timeSec, which reached
+    // the page at arrivalSec (performance.now() seconds). With a valid time the
+    // orientation is shown by updateInterpolated() on the next frames,
+    // otherwise it's applied straight away.
+    updateOrientationFromEuler(eulerDeg: { roll: number; pitch: number; yaw: number }, timeSec: number, arrivalSec: number) {
         if (!this.model) return;
         const qSensor = new THREE.Quaternion().setFromEuler(
             new THREE.Euler(this.degToRad(eulerDeg.roll), this.degToRad(eulerDeg.pitch), this.degToRad(eulerDeg.yaw), 'ZYX')
@@ -240,10 +246,26 @@ export class PCBModel {
         // Map sensor quaternion into model frame via conjugation by the fixed basis transform Rx(-90°)
         const qTarget = this.sensorToModel.clone().multiply(qSensor).multiply(this.sensorToModel.clone().invert());
 
+        if (isFinite(timeSec)) {
+            this.interpolator.push(qTarget, timeSec, arrivalSec);
+            return;
+        }
         this.quaternion.copy(qTarget);
         this.applyRotationToModel();
     }
 
+    // render loop - show the buffered Euler orientations interpolated to now
+    updateInterpolated() {
+        if (this.interpolator.sample(performance.now() / 1000, this.quaternion)) {
+            this.applyRotationToModel();
+        }
+    }
+
+    // forget buffered orientations, e.g. when switching to accelerometer mode
+    resetInterpolation() {
+        this.interpolator.reset();
+    }
+
     private degToRad(d: number) { return d * Math.PI / 180; }
     // radToDeg no longer used; keep degToRad only
 
@@ -259,6 +281,7 @@ export class PCBModel {
 
     // Explicitly reset the model orientation quaternion to identity
     resetModelOrientation() {
+        this.interpolator.reset();
         this.quaternion.identity();
         this.applyRotationToModel();
     }
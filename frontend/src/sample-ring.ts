@@ -0,0 +1,97 @@
+import { SensorData } from './sensor-types';
+
+// floats per sample - the BLE packet layout:
+// ax, ay, az, gx, gy, gz, gyroIntRoll, gyroIntPitch, gyroIntYaw, fusionRoll,
+// fusionPitch, fusionYaw, tempC, timeSec, predictedRoll, predictedPitch,
+// predictedYaw, predictionMs
+export const SAMPLE_STRIDE = 18;
+
+// header is one Int32 (samples ever written), padded to keep the data aligned
+const HEADER_BYTES = 8;
+
+// when the decode worker got the bytes a sample came in - ms since the epoch
+// (performance.timeOrigin + performance.now()), so it means the same on both
+// sides of the worker boundary
+export function arrivalNow(): number {
+  return performance.timeOrigin + performance.now();
+}
+
+/**
+ * Single-producer / single-consumer ring of decoded samples. The decode worker
+ * writes into it and the render loop reads everything new once per frame.
+ * When the page is cross-origin isolated the buffer is a SharedArrayBuffer so
+ * both sides see the same memory; otherwise each side keeps its own copy.
+ */
+export class SampleRing {
+  readonly buffer: ArrayBuffer | SharedArrayBuffer;
+  readonly capacity: number;
+  // samples overwritten before the consumer got to them
+  dropped = 0;
+  private header: Int32Array;
+  private data: Float32Array;
+  // arrival time of each sample, see arrivalNow()
+  private arrivals: Float64Array;
+
+  // capacity must be a power of two
+  static byteLength(capacity: number): number {
+    return HEADER_BYTES + capacity * (SAMPLE_STRIDE * 4 + 8);
+  }
+
+  constructor(buffer: ArrayBuffer | SharedArrayBuffer) {
+    this.buffer = buffer;
+    this.capacity = (buffer.byteLength - HEADER_BYTES) / (SAMPLE_STRIDE * 4 + 8);
+    this.header = new Int32Array(buffer, 0, 1);
+    this.data = new Float32Array(buffer, HEADER_BYTES, this.capacity * SAMPLE_STRIDE);
+    this.arrivals = new Float64Array(buffer, HEADER_BYTES + this.capacity * SAMPLE_STRIDE * 4, this.capacity);
+  }
+
+  get written(): number {
+    return Atomics.load(this.header, 0);
+  }
+
+  // producer - SAMPLE_STRIDE floats starting at offset, and when they arrived
+  push(values: Float32Array, offset: number, arrival: number) {
+    const count = Atomics.load(this.header, 0);
+    const slot = count & (this.capacity - 1);
+    const index = slot * SAMPLE_STRIDE;
+    this.data.set(values.subarray(offset, offset + SAMPLE_STRIDE), index);
+    this.arrivals[slot] = arrival;
+    // publish after the data is in place
+    Atomics.store(this.header, 0, (count + 1) | 0);
+  }
+
+  // consumer - calls fn with a view of each sample written since cursor and
+  // its arrival time, and returns the new cursor. The view is only valid
+  // during the call.
+  drain(cursor: number, fn: (sample: Float32Array, arrival: number) => void): number {
+    const written = Atomics.load(this.header, 0);
+    let pending = (written - cursor) | 0;
+    if (pending > this.capacity) {
+      // lapped - skip to the oldest sample still in the ring
+      this.dropped += pending - this.capacity;
+      cursor = (written - this.capacity) | 0;
+      pending = this.capacity;
+    }
+    for (let i = 0; i < pending; i++) {
+      const slot = (cursor + i) & (this.capacity - 1);
+      const index = slot * SAMPLE_STRIDE;
+      fn(this.data.subarray(index, index + SAMPLE_STRIDE), this.arrivals[slot]);
+    }
+    return written;
+  }
+
+  // arrival is converted to this side's performance.now() clock
+  static toSensorData(v: Float32Array, arrival: number): SensorData {
+    const data: SensorData = {
+      accel: { x: v[0], y: v[1], z: v[2] },
+      gyro: { x: v[3], y: v[4], z: v[5] },
+      gyroInt: { roll: v[6], pitch: v[7], yaw: v[8] },
+      fusion: { roll: v[9], pitch: v[10], yaw: v[11] },
+      temperature: v[12],
+      t: v[13],
+      arrival: (arrival - performance.timeOrigin) / 1000,
+    };
+    if (v[17] > 0) data.predicted = { roll: v[14], pitch: v[15], yaw: v[16], ms: v[17] };
+    return data;
+  }
+}
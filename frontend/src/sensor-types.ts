@@ -3,8 +3,11 @@ export interface SensorData {
   gyro: { x: number; y: number; z: number };
   gyroInt: { roll: number; pitch: number; yaw: number };
   fusion: { roll: number; pitch: number; yaw: number };
+  // fusion orientation extrapolated ms ahead by the firmware (PREDICT command)
+  predicted?: { roll: number; pitch: number; yaw: number; ms: number };
   temperature: number;
   t: number; // absolute device time in seconds since boot (from firmware)
+  arrival: number; // performance.now() in seconds when the decoder got it
 }
 
 
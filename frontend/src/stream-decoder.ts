@@ -0,0 +1,115 @@
+import { SensorData } from './sensor-types';
+import { SampleRing, SAMPLE_STRIDE } from './sample-ring';
+
+// Messages to and from decode-worker.ts
+export type DecoderRequest =
+    | { type: 'init'; buffer: SharedArrayBuffer | null }
+    | { type: 'serial'; chunk: Uint8Array }
+    | { type: 'ble'; packet: ArrayBuffer }
+    | { type: 'fused'; values: Float32Array; arrivals: Float64Array }
+    | { type: 'reset' };
+
+export type DecoderResponse =
+    | { type: 'samples'; values: Float32Array; arrivals: Float64Array }
+    | { type: 'deviceError'; message: string }
+    | { type: 'rawLines'; lines: string[]; arrival: number };
+
+// samples buffered between frames - a few seconds at full IMU rate
+const RING_CAPACITY = 4096;
+
+interface StreamDecoderEvents {
+    deviceError: (message: string) => void;
+    // arrival is when the chunk they came in reached the worker, see arrivalNow()
+    rawLines: (lines: string[], arrival: number) => void;
+}
+
+/**
+ * Decodes everything the transports receive in a Web Worker. The connection
+ * managers hand over raw bytes/packets; the render loop calls drain() once a
+ * frame to pick up every sample decoded since.
+ */
+export class StreamDecoder {
+    private worker: Worker;
+    private ring: SampleRing;
+    private cursor = 0;
+    private eventListeners: { [K in keyof StreamDecoderEvents]?: StreamDecoderEvents[K][] } = {};
+    // true if the worker writes straight into the ring
+    readonly shared: boolean;
+
+    constructor() {
+        // SharedArrayBuffer needs the COOP/COEP headers set in vite.config.ts
+        this.shared = typeof SharedArrayBuffer !== 'undefined' && self.crossOriginIsolated === true;
+        const bytes = SampleRing.byteLength(RING_CAPACITY);
+        this.ring = new SampleRing(this.shared ? new SharedArrayBuffer(bytes) : new ArrayBuffer(bytes));
+        this.worker = new Worker(new URL('./decode-worker.ts', import.meta.url), { type: 'module' });
+        this.worker.onmessage = (event: MessageEvent<DecoderResponse>) => {
+            const message = event.data;
+            if (message.type === 'samples') {
+                for (let i = 0; i < message.arrivals.length; i++) {
+                    this.ring.push(message.values, i * SAMPLE_STRIDE, message.arrivals[i]);
+                }
+            } else if (message.type === 'deviceError') {
+                this.emit('deviceError', message.message);
+            } else if (message.type === 'rawLines') {
+                this.emit('rawLines', message.lines, message.arrival);
+            }
+        };
+        this.post({ type: 'init', buffer: this.shared ? (this.ring.buffer as SharedArrayBuffer) : null });
+    }
+
+    on<K extends keyof StreamDecoderEvents>(event: K, callback: StreamDecoderEvents[K]) {
+        if (!this.eventListeners[event]) {
+            this.eventListeners[event] = [];
+        }
+        this.eventListeners[event]!.push(callback);
+    }
+
+    private emit<K extends keyof StreamDecoderEvents>(event: K, ...args: Parameters<StreamDecoderEvents[K]>) {
+        this.eventListeners[event]?.forEach(callback => {
+            (callback as (...args: Parameters<StreamDecoderEvents[K]>) => void)(...args);
+        });
+    }
+
+    private post(message: DecoderRequest, transfer: Transferable[] = []) {
+        this.worker.postMessage(message, transfer);
+    }
+
+    // bytes read from the serial port - ownership passes to the worker
+    pushSerial(chunk: Uint8Array) {
+        const own = chunk.byteOffset === 0 && chunk.byteLength === chunk.buffer.byteLength ? chunk : chunk.slice();
+        this.post({ type: 'serial', chunk: own }, [own.buffer as ArrayBuffer]);
+    }
+
+    // a BLE packet characteristic notification
+    pushBle(dv: DataView) {
+        const packet = dv.buffer.slice(dv.byteOffset, dv.byteOffset + dv.byteLength);
+        this.post({ type: 'ble', packet }, [packet]);
+    }
+
+    // samples fused in the browser, already in the ring layout, with the
+    // arrival times of the raw lines they were fused from
+    pushFused(values: Float32Array, arrivals: Float64Array) {
+        this.post({ type: 'fused', values, arrivals }, [values.buffer as ArrayBuffer, arrivals.buffer as ArrayBuffer]);
+    }
+
+    // new connection - forget any partial line and anything not yet drawn
+    reset() {
+        this.post({ type: 'reset' });
+        this.cursor = this.ring.written;
+    }
+
+    get dropped(): number {
+        return this.ring.dropped;
+    }
+
+    // render loop - calls fn for each sample decoded since the last call and
+    // returns how many there were
+    drain(fn: (data: SensorData) => void): number {
+        let count = 0;
+        this.cursor = this.ring.drain(this.cursor, (v, arrival) => {
+            fn(SampleRing.toSensorData(v, arrival));
+            count++;
+        });
+        return count;
+    }
+}
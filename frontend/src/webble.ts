@@ -1,4 +1,4 @@
-import { SensorData } from './sensor-types';
+import { StreamDecoder } from './stream-decoder';
 
 // GATT UUIDs must match firmware
 const SERVICE_UUID = '9c2a8b2a-6c7a-4b8b-bf3c-7f6b1f7f0001';
@@ -8,28 +8,21 @@ const CONTROL_UUID = '9c2a8b2a-6c7a-4b8b-bf3c-7f6b1f7f1001';
 type WebBLEEvents = {
   connected: () => void;
   disconnected: () => void;
-  data: (data: SensorData) => void;
   error: (error: Error) => void;
 };
 
+// BLE connection; packets are decoded in the StreamDecoder's worker
 export class WebBLEManager {
+  private decoder: StreamDecoder;
   private device: BluetoothDevice | null = null;
   private server: BluetoothRemoteGATTServer | null = null;
   private packetChar: BluetoothRemoteGATTCharacteristic | null = null;
   private controlChar: BluetoothRemoteGATTCharacteristic | null = null;
   private eventListeners: { [K in keyof WebBLEEvents]?: WebBLEEvents[K][] } = {};
-  // No polling path in the combined characteristic implementation
-
-  // Keep latest values from notifications to emit combined packets
-  private latestAccel: { x: number; y: number; z: number } | null = null;
-  private latestGyro: { x: number; y: number; z: number } | null = null;
-  private latestGyroInt: { roll: number; pitch: number; yaw: number } | null = null;
-  private latestFusion: { roll: number; pitch: number; yaw: number } | null = null;
-  private latestTemp: number | null = null;
-  private emitScheduled = false;
-  private latestTimeSec: number | null = null; // absolute device time
-  // Track whether we actually receive notifications on the packet characteristic; if not, enable fallback polling (none now)
-  // private packetNotified = false; // informational only
+
+  constructor(decoder: StreamDecoder) {
+    this.decoder = decoder;
+  }
 
   static isSupported(): boolean {
     return typeof navigator !== 'undefined' && typeof (navigator as unknown as Navigator).bluetooth !== 'undefined';
@@ -79,6 +72,7 @@ export class WebBLEManager {
         this.controlChar = null; // tolerate firmware without control char
       }
 
+      this.decoder.reset();
       await this.startNotifications();
       // Optionally, could add a timeout to check packetNotified and handle errors
       this.emit('connected');
@@ -102,12 +96,6 @@ export class WebBLEManager {
     this.server = null;
     this.packetChar = null;
     this.controlChar = null;
-    this.latestAccel = null;
-    this.latestGyro = null;
-    this.latestFusion = null;
-    this.latestGyroInt = null;
-    this.latestTemp = null;
-    this.emitScheduled = false;
     this.emit('disconnected');
   }
 
@@ -147,41 +135,7 @@ export class WebBLEManager {
       }
     };
 
-    // Combined packet notification
-    await tryStart(this.packetChar, (dv) => {
-      // Packet layout: 11 float32 little-endian
-      const values = new Float32Array(14);
-      for (let i = 0; i < 14; i++) values[i] = dv.getFloat32(i * 4, true);
-      this.latestAccel = { x: values[0], y: values[1], z: values[2] };
-      this.latestGyro = { x: values[3], y: values[4], z: values[5] };
-      this.latestGyroInt = { roll: values[6], pitch: values[7], yaw: values[8] };
-      this.latestFusion = { roll: values[9], pitch: values[10], yaw: values[11] };
-      this.latestTemp = values[12];
-      this.latestTimeSec = isFinite(values[13]) ? values[13] : null;
-      // packet received
-      this.scheduleEmitIfReady();
-    });
-  }
-
-  private scheduleEmitIfReady() {
-    if (this.emitScheduled) return;
-    // Require mandatory fields before first emit
-    if (!this.latestAccel || !this.latestGyro || this.latestTemp === null) return;
-    this.emitScheduled = true;
-    // Coalesce multiple notifications in the same tick
-    queueMicrotask(() => {
-      this.emitScheduled = false;
-      const packet: SensorData = {
-        accel: this.latestAccel!,
-        gyro: this.latestGyro!,
-        gyroInt: this.latestGyroInt!,
-        fusion: this.latestFusion!,
-        temperature: this.latestTemp!,
-        t: this.latestTimeSec ?? 0,
-      };
-      this.emit('data', packet);
-    });
+    // Combined packet notification - decoded off the main thread
+    await tryStart(this.packetChar, (dv) => this.decoder.pushBle(dv));
   }
 }
-
-
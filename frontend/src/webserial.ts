@@ -1,16 +1,17 @@
-import { SensorData } from "./sensor-types";
+import { StreamDecoder } from "./stream-decoder";
 
 interface WebSerialEvents {
     connected: () => void;
     disconnected: () => void;
-    data: (data: SensorData) => void;
-    deviceError: (message: string) => void;
-    rawLine: (line: string) => void;
     error: (error: Error) => void;
 }
 
+// Reads the serial port; decoding happens in the StreamDecoder's worker
 export class WebSerialManager {
-    constructor() {
+    private decoder: StreamDecoder;
+
+    constructor(decoder: StreamDecoder) {
+        this.decoder = decoder;
         // Listen for device unplug/reset events so UI updates when connection is lost unexpectedly
         if (WebSerialManager.isSupported()) {
             try {
@@ -33,9 +34,7 @@ export class WebSerialManager {
 
     private port: SerialPort | null = null;
     private reader: ReadableStreamDefaultReader<Uint8Array> | null = null;
-    private decoder = new TextDecoder();
     private encoder = new TextEncoder();
-    private buffer = '';
     private eventListeners: { [K in keyof WebSerialEvents]?: WebSerialEvents[K][] } = {};
 
     get isConnected(): boolean {
@@ -96,6 +95,7 @@ export class WebSerialManager {
             });
 
             this.reader = this.port.readable!.getReader();
+            this.decoder.reset();
 
             this.emit('connected');
             this.startReading();
@@ -122,20 +122,8 @@ export class WebSerialManager {
                 
                 if (done) break;
                 
-                // Convert bytes to string and add to buffer
-                const chunk = this.decoder.decode(value, { stream: true });
-                this.buffer += chunk;
-                
-                // Process complete lines
-                const lines = this.buffer.split('\n');
-                this.buffer = lines.pop() || ''; // Keep incomplete line in buffer
-                
-                for (const line of lines) {
-                    const trimmed = line.trim();
-                    if (!trimmed) continue;
-                    this.emit('rawLine', trimmed);
-                    this.processLine(trimmed);
-                }
+                // hand the bytes straight to the decode worker
+                this.decoder.pushSerial(value);
             }
         } catch (error) {
             console.error('Reading error:', error);
@@ -165,54 +153,4 @@ export class WebSerialManager {
             this.emit('disconnected');
         }
     }
-
-    private processLine(line: string) {
-            // Parse ESP32S3 JSON sensor output format:
-            // {"accel":{"x":0.123,"y":0.456,"z":0.789},"gyro":{"x":1.23,"y":4.56,"z":7.89},"temp":25.4,"euler":{"roll":..,"pitch":..,"yaw":..},"t":123.456}
-        
-        // Skip empty lines or lines that don't look like JSON
-        if (!line.trim() || !line.includes('{') || !line.includes('}')) {
-            return;
-        }
-
-            try {
-            const jsonData = JSON.parse(line.trim());
-            
-            // Validate JSON structure
-            if (jsonData.accel && jsonData.gyro && jsonData.gyroInt && jsonData.fusion && typeof jsonData.temp === 'number') {
-                const sensorData: SensorData = {
-                    accel: {
-                        x: jsonData.accel.x,
-                        y: jsonData.accel.y,
-                        z: jsonData.accel.z
-                    },
-                    gyro: {
-                        x: jsonData.gyro.x,
-                        y: jsonData.gyro.y,
-                        z: jsonData.gyro.z
-                    },
-                    gyroInt: {
-                        roll: jsonData.gyroInt.roll,
-                        pitch: jsonData.gyroInt.pitch,
-                        yaw: jsonData.gyroInt.yaw
-                    },
-                    fusion: {
-                        roll: jsonData.fusion.roll,
-                        pitch: jsonData.fusion.pitch,
-                        yaw: jsonData.fusion.yaw
-                    },
-                    temperature: jsonData.temp,
-                    t: jsonData.t
-                };
-                this.emit('data', sensorData);
-            } else if (typeof jsonData.error === 'string') {
-                // Valid JSON error object: {"error":"..."}
-                this.emit('deviceError', jsonData.error);
-            } else {
-                console.warn('Invalid JSON structure:', jsonData);
-            }
-        } catch {
-            console.log("Non-JSON line:", line);
-        }
-    }
-}
\ No newline at end of file
+}
@@ -1,10 +1,21 @@
 import { defineConfig } from 'vite'
 
+// Cross-origin isolation lets the decode worker share its sample ring with the
+// page (SharedArrayBuffer). Without it the worker posts samples instead.
+const isolationHeaders = {
+  'Cross-Origin-Opener-Policy': 'same-origin',
+  'Cross-Origin-Embedder-Policy': 'require-corp'
+}
+
 export default defineConfig({
   server: {
     port: 5173,
     host: true,
-    https: false
+    https: false,
+    headers: isolationHeaders
+  },
+  preview: {
+    headers: isolationHeaders
   },
   build: {
     outDir: 'dist',
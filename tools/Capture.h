@@ -0,0 +1,139 @@
+#pragma once
+
+// Loader for raw captures recorded from the device with the STREAM_RAW serial
+// command. Each data line is
+//
+//   time_us,gx,gy,gz,ax,ay,az,temp[,qw,qx,qy,qz]
+//
+// with the gyro in deg/s before offset correction and the accelerometer in g.
+// The optional trailing quaternion is a reference orientation (e.g. from a
+// motion capture rig) used to score replays. Any line that doesn't start with
+// a number (JSON output, headers, comments) is skipped so the output of
+// `pio device monitor` can be used as is - except that SYNC event lines are
+// collected as shared timing marks, and the samples of a trigger burst (which
+// repeat ones already in the stream) are left out.
+
+#include "Fusion.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <fstream>
+#include <string>
+#include <vector>
+
+struct CaptureSample {
+  uint32_t timeMicros;
+  FusionVector gyroscope;
+  FusionVector accelerometer;
+  float temperatureC;
+  FusionQuaternion reference;
+};
+
+struct Capture {
+  std::string name;
+  std::vector<CaptureSample> samples;
+  // true if every sample carries a reference orientation
+  bool hasReference = false;
+  // device time of each sync edge - microseconds. These are the sync input
+  // edges, or the unit's own output edges if it was the master and never saw
+  // an input.
+  std::vector<uint32_t> syncMicros;
+};
+
+// value of a numeric "key": field in a JSON event line
+static inline bool findJsonNumber(const std::string &line, const char *key, unsigned long &value) {
+  const std::string quoted = std::string("\"") + key + "\":";
+  const size_t at = line.find(quoted);
+  if (at == std::string::npos) return false;
+  value = strtoul(line.c_str() + at + quoted.size(), nullptr, 10);
+  return true;
+}
+
+// sample count of a {"burst":{...,"samples":N,...}} trigger burst header. The
+// N lines after it repeat samples that were already streamed, so readers skip
+// them rather than see time go backwards
+static inline bool parseBurstHeader(const std::string &line, unsigned long &samples) {
+  return line.find("\"burst\":") != std::string::npos && findJsonNumber(line, "samples", samples);
+}
+
+static inline bool parseCaptureLine(const std::string &line, CaptureSample &sample, bool &hasReference) {
+  if (line.empty()) return false;
+  const char c = line[0];
+  if (!((c >= '0' && c <= '9') || c == '-' || c == '+')) return false;
+
+  float values[12];
+  int count = 0;
+  const char *p = line.c_str();
+  while (count < 12) {
+    char *end;
+    const float v = strtof(p, &end);
+    if (end == p) break;
+    values[count++] = v;
+    p = end;
+    while (*p == ' ' || *p == '\t') p++;
+    if (*p != ',') break;
+    p++;
+  }
+  if (count != 8 && count != 12) return false;
+
+  // time needs full integer precision, re-parse it rather than use the float
+  sample.timeMicros = (uint32_t)strtoul(line.c_str(), nullptr, 10);
+  sample.gyroscope = {.axis = {.x = values[1], .y = values[2], .z = values[3]}};
+  sample.accelerometer = {.axis = {.x = values[4], .y = values[5], .z = values[6]}};
+  sample.temperatureC = values[7];
+  hasReference = count == 12;
+  if (hasReference) {
+    sample.reference = {.element = {.w = values[8], .x = values[9], .y = values[10], .z = values[11]}};
+    sample.reference = FusionQuaternionNormalise(sample.reference);
+  } else {
+    sample.reference = FUSION_IDENTITY_QUATERNION;
+  }
+  return true;
+}
+
+// Returns false and fills in error if the file can't be read or has no samples
+static inline bool loadCapture(const std::string &path, Capture &capture, std::string &error) {
+  std::ifstream file(path);
+  if (!file) {
+    error = "cannot open " + path;
+    return false;
+  }
+  capture.name = path;
+  capture.samples.clear();
+  capture.syncMicros.clear();
+  bool allReferenced = true;
+  std::vector<uint32_t> outputSyncMicros;
+  unsigned long burstLines = 0;
+  std::string line;
+  while (std::getline(file, line)) {
+    unsigned long value;
+    if (parseBurstHeader(line, value)) {
+      burstLines = value;
+      continue;
+    }
+    if (burstLines > 0) {
+      burstLines--;
+      continue;
+    }
+    if (line.find("\"type\":\"SYNC\",\"id\":0,") != std::string::npos && findJsonNumber(line, "us", value)) {
+      capture.syncMicros.push_back((uint32_t)value);
+      continue;
+    }
+    if (line.find("\"type\":\"SYNC\",\"id\":1,") != std::string::npos && findJsonNumber(line, "us", value)) {
+      outputSyncMicros.push_back((uint32_t)value);
+      continue;
+    }
+    CaptureSample sample;
+    bool referenced;
+    if (parseCaptureLine(line, sample, referenced)) {
+      capture.samples.push_back(sample);
+      allReferenced = allReferenced && referenced;
+    }
+  }
+  if (capture.samples.empty()) {
+    error = "no samples in " + path;
+    return false;
+  }
+  capture.hasReference = allReferenced;
+  if (capture.syncMicros.empty()) capture.syncMicros = outputSyncMicros;
+  return true;
+}
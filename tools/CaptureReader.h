@@ -0,0 +1,449 @@
+#pragma once
+
+// Fast columnar loader for everything the tools and the hub record, for
+// analysis code (see imu_capture_py.cpp for the Python bindings). It reads
+//
+//  - STREAM_RAW captures (Capture.h format): time_us, gx..az, temp and the
+//    reference qw..qz if every sample has one
+//  - the SerialTransport JSON stream: time_us, ax..az, gx..gz (offset
+//    corrected), temp, roll/pitch/yaw and the integrated gyro_roll/pitch/yaw
+//  - imu_hub columnar recordings (a directory): each column file is memory
+//    mapped rather than read
+//
+// Text files are memory mapped and split into chunks at line boundaries that
+// are parsed on all cores. Trigger bursts are skipped as Capture.h does, and
+// micros() wraps are unwrapped so time_us keeps increasing. Which of the two
+// text formats a file is in is decided by its first sample line; lines in the
+// other format are ignored.
+
+#include <algorithm>
+#include <fcntl.h>
+#include <math.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+enum ColumnType {
+  COLUMN_F32,
+  COLUMN_I64,
+  COLUMN_U32,
+  COLUMN_U16,
+};
+
+struct CaptureColumn {
+  std::string name;
+  ColumnType type;
+  // owned by the reader, valid for as long as it is
+  const void *data;
+};
+
+class CaptureReader {
+private:
+  enum TextFormat {
+    TEXT_UNKNOWN,
+    TEXT_RAW,
+    TEXT_JSON,
+  };
+
+  // widest row either text format produces (raw with a reference)
+  static const int MAX_VALUES = 13;
+  static const int RAW_VALUES = 12;
+  static const int JSON_VALUES = 14;
+
+  struct Row {
+    // line number within its chunk
+    uint32_t line;
+    // time_us (raw) or t in microseconds (JSON)
+    int64_t time;
+    float values[MAX_VALUES];
+    bool referenced;
+  };
+
+  struct Chunk {
+    const char *begin;
+    const char *end;
+    uint32_t lines = 0;
+    std::vector<Row> rows;
+    // (line, samples) of each {"burst":...} header
+    std::vector<std::pair<uint32_t, uint32_t>> bursts;
+  };
+
+  struct Mapping {
+    void *data;
+    size_t length;
+  };
+
+  std::vector<CaptureColumn> columnList;
+  size_t rowCount = 0;
+  std::vector<int64_t> times;
+  std::vector<std::vector<float>> floats;
+  std::vector<Mapping> mappings;
+  std::vector<std::string> unitNameList;
+
+  // Decimal number as the firmware's ostream formatting writes them, e.g.
+  // -12.5, 1.5e-05. Quicker than strtof and locale independent.
+  static bool parseNumber(const char *&p, const char *end, double &value) {
+    const char *s = p;
+    bool negative = false;
+    if (s < end && (*s == '-' || *s == '+')) negative = *s++ == '-';
+    uint64_t mantissa = 0;
+    int exponent = 0;
+    int digits = 0;
+    bool any = false;
+    for (; s < end && *s >= '0' && *s <= '9'; s++, any = true) {
+      if (digits < 19) {
+        mantissa = mantissa * 10 + (*s - '0');
+        if (mantissa) digits++;
+      } else {
+        exponent++;
+      }
+    }
+    if (s < end && *s == '.') {
+      for (s++; s < end && *s >= '0' && *s <= '9'; s++, any = true) {
+        if (digits < 19) {
+          mantissa = mantissa * 10 + (*s - '0');
+          if (mantissa) digits++;
+          exponent--;
+        }
+      }
+    }
+    if (!any) return false;
+    if (s < end && (*s == 'e' || *s == 'E')) {
+      const char *e = s + 1;
+      bool negativeExponent = false;
+      if (e < end && (*e == '-' || *e == '+')) negativeExponent = *e++ == '-';
+      int power = 0;
+      bool exponentDigits = false;
+      for (; e < end && *e >= '0' && *e <= '9'; e++, exponentDigits = true) power = power * 10 + (*e - '0');
+      if (exponentDigits) {
+        exponent += negativeExponent ? -power : power;
+        s = e;
+      }
+    }
+    static const double powers[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11};
+    if (exponent == 0) {
+      value = (double)mantissa;
+    } else if (exponent < 0 && exponent > -12) {
+      value = (double)mantissa / powers[-exponent];
+    } else if (exponent > 0 && exponent < 12) {
+      value = (double)mantissa * powers[exponent];
+    } else {
+      value = (double)mantissa * pow(10.0, exponent);
+    }
+    if (negative) value = -value;
+    p = s;
+    return true;
+  }
+
+  // time_us,gx,gy,gz,ax,ay,az,temp[,qw,qx,qy,qz]
+  static bool parseRaw(const char *p, const char *end, Row &row) {
+    double values[RAW_VALUES];
+    int count = 0;
+    while (count < RAW_VALUES) {
+      if (!parseNumber(p, end, values[count])) break;
+      count++;
+      while (p < end && (*p == ' ' || *p == '\t')) p++;
+      if (p >= end || *p != ',') break;
+      p++;
+      while (p < end && (*p == ' ' || *p == '\t')) p++;
+    }
+    if (count != 8 && count != 12) return false;
+    row.time = (int64_t)values[0];
+    for (int i = 1; i < count; i++) row.values[i - 1] = (float)values[i];
+    row.referenced = count == 12;
+    if (row.referenced) {
+      // normalised like Capture.h
+      float *q = row.values + 7;
+      const float norm = sqrtf(q[0] * q[0] + q[1] * q[1] + q[2] * q[2] + q[3] * q[3]);
+      if (norm > 0.0f) {
+        for (int i = 0; i < 4; i++) q[i] /= norm;
+      }
+    }
+    return true;
+  }
+
+  // {"accel":{x,y,z},"gyro":{x,y,z},"temp":..,"fusion":{roll,pitch,yaw},
+  // "gyroInt":{roll,pitch,yaw}[,"predicted":{roll,pitch,yaw,ms}],"t":..} -
+  // the numbers always come in this order, so just take them as they come
+  static bool parseJson(const char *p, const char *end, Row &row) {
+    static const char prefix[] = "{\"accel\":";
+    if (end - p < (ptrdiff_t)sizeof(prefix) - 1 || memcmp(p, prefix, sizeof(prefix) - 1) != 0) return false;
+    double values[JSON_VALUES + 4];
+    int count = 0;
+    for (; p < end && count < JSON_VALUES + 4; p++) {
+      if (*p != ':') continue;
+      const char *number = p + 1;
+      if (number < end && *number != '{') {
+        if (!parseNumber(number, end, values[count])) return false;
+        count++;
+        p = number - 1;
+      }
+    }
+    if (count != JSON_VALUES && count != JSON_VALUES + 4) return false;
+    // t is last, in seconds
+    row.time = llround(values[count - 1] * 1e6);
+    for (int i = 0; i < JSON_VALUES - 1; i++) row.values[i] = (float)values[i];
+    row.referenced = false;
+    return true;
+  }
+
+  static TextFormat detectFormat(const char *p, const char *end) {
+    while (p < end) {
+      const char *eol = (const char *)memchr(p, '\n', end - p);
+      const char *lineEnd = eol ? eol : end;
+      Row row;
+      if (parseJson(p, lineEnd, row)) return TEXT_JSON;
+      if (p < lineEnd && ((*p >= '0' && *p <= '9') || *p == '-' || *p == '+') && parseRaw(p, lineEnd, row)) {
+        return TEXT_RAW;
+      }
+      p = lineEnd + 1;
+    }
+    return TEXT_UNKNOWN;
+  }
+
+  static void parseChunk(Chunk &chunk, TextFormat format) {
+    static const char burstKey[] = "\"burst\":";
+    static const char samplesKey[] = "\"samples\":";
+    const char *p = chunk.begin;
+    while (p < chunk.end) {
+      const char *eol = (const char *)memchr(p, '\n', chunk.end - p);
+      const char *lineEnd = eol ? eol : chunk.end;
+      const uint32_t line = chunk.lines++;
+      if (p < lineEnd) {
+        Row row;
+        row.line = line;
+        if (*p == '{') {
+          if (format == TEXT_JSON && parseJson(p, lineEnd, row)) {
+            chunk.rows.push_back(row);
+          } else if (lineEnd - p > 16 && memmem(p, lineEnd - p, burstKey, sizeof(burstKey) - 1)) {
+            const char *samples = (const char *)memmem(p, lineEnd - p, samplesKey, sizeof(samplesKey) - 1);
+            if (samples) {
+              chunk.bursts.push_back({line, (uint32_t)strtoul(samples + sizeof(samplesKey) - 1, nullptr, 10)});
+            }
+          }
+        } else if (format == TEXT_RAW && ((*p >= '0' && *p <= '9') || *p == '-' || *p == '+') &&
+                   parseRaw(p, lineEnd, row)) {
+          chunk.rows.push_back(row);
+        }
+      }
+      p = lineEnd + 1;
+    }
+  }
+
+  bool mapFile(const std::string &path, Mapping &mapping, std::string &error) {
+    const int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+      error = "cannot open " + path;
+      return false;
+    }
+    struct stat st;
+    fstat(fd, &st);
+    mapping.length = st.st_size;
+    mapping.data = nullptr;
+    if (mapping.length > 0) {
+      // private and writable - changes from Python are copy-on-write and
+      // never reach the file
+      mapping.data = mmap(nullptr, mapping.length, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+      if (mapping.data == MAP_FAILED) {
+        ::close(fd);
+        error = "cannot map " + path;
+        return false;
+      }
+    }
+    ::close(fd);
+    mappings.push_back(mapping);
+    return true;
+  }
+
+  void addFloatColumns(const char *const *names, int count) {
+    for (int i = 0; i < count; i++) {
+      columnList.push_back({names[i], COLUMN_F32, floats[i].data()});
+    }
+  }
+
+  bool openText(const std::string &path, unsigned int threadCount, std::string &error) {
+    Mapping file;
+    if (!mapFile(path, file, error)) return false;
+    const char *begin = (const char *)file.data;
+    const char *end = begin + file.length;
+    const TextFormat format = detectFormat(begin, end);
+    if (format == TEXT_UNKNOWN) {
+      error = "no samples in " + path;
+      return false;
+    }
+
+    // split at line boundaries, a few chunks per thread to even out the load
+    const size_t chunkCount = std::max<size_t>(1, std::min<size_t>(threadCount * 4, file.length / 65536));
+    std::vector<Chunk> chunks(chunkCount);
+    const char *p = begin;
+    for (size_t i = 0; i < chunkCount; i++) {
+      const char *target = i + 1 == chunkCount ? end : begin + file.length * (i + 1) / chunkCount;
+      if (target < p) target = p;
+      const char *eol = target < end ? (const char *)memchr(target, '\n', end - target) : nullptr;
+      chunks[i].begin = p;
+      chunks[i].end = i + 1 == chunkCount || !eol ? end : eol + 1;
+      p = chunks[i].end;
+    }
+    std::vector<std::thread> workers;
+    for (unsigned int t = 0; t < std::min<size_t>(threadCount, chunkCount); t++) {
+      workers.emplace_back([&, t]() {
+        for (size_t i = t; i < chunkCount; i += threadCount) parseChunk(chunks[i], format);
+      });
+    }
+    for (std::thread &worker : workers) worker.join();
+
+    // stitch the chunks together in order, dropping the lines of each burst
+    size_t total = 0;
+    for (const Chunk &chunk : chunks) total += chunk.rows.size();
+    const int valueCount = format == TEXT_RAW ? RAW_VALUES - 1 : JSON_VALUES - 1;
+    times.reserve(total);
+    floats.assign(valueCount, std::vector<float>());
+    for (std::vector<float> &column : floats) column.reserve(total);
+    bool allReferenced = true;
+    uint64_t lineBase = 0;
+    uint64_t skipUntil = 0;
+    uint32_t lastRaw = 0;
+    int64_t unwrapped = 0;
+    for (const Chunk &chunk : chunks) {
+      size_t burst = 0;
+      for (const Row &row : chunk.rows) {
+        const uint64_t line = lineBase + row.line;
+        for (; burst < chunk.bursts.size() && chunk.bursts[burst].first < row.line; burst++) {
+          skipUntil = lineBase + chunk.bursts[burst].first + chunk.bursts[burst].second;
+        }
+        if (line <= skipUntil && skipUntil > 0) continue;
+        if (format == TEXT_RAW) {
+          const uint32_t raw = (uint32_t)row.time;
+          unwrapped = times.empty() ? raw : unwrapped + (int32_t)(raw - lastRaw);
+          lastRaw = raw;
+          times.push_back(unwrapped);
+          allReferenced = allReferenced && row.referenced;
+        } else {
+          times.push_back(row.time);
+        }
+        for (int i = 0; i < valueCount; i++) {
+          floats[i].push_back(row.referenced || i < 7 || format == TEXT_JSON ? row.values[i] : 0.0f);
+        }
+      }
+      for (; burst < chunk.bursts.size(); burst++) {
+        skipUntil = lineBase + chunk.bursts[burst].first + chunk.bursts[burst].second;
+      }
+      lineBase += chunk.lines;
+    }
+    // the text is no longer needed
+    munmap(file.data, file.length);
+    mappings.pop_back();
+    if (times.empty()) {
+      error = "no samples in " + path;
+      return false;
+    }
+    rowCount = times.size();
+
+    columnList.push_back({"time_us", COLUMN_I64, times.data()});
+    if (format == TEXT_RAW) {
+      static const char *const names[RAW_VALUES - 1] = {"gx", "gy", "gz", "ax", "ay", "az", "temp",
+                                                        "qw", "qx", "qy", "qz"};
+      if (!allReferenced) floats.resize(7);
+      addFloatColumns(names, (int)floats.size());
+    } else {
+      static const char *const names[JSON_VALUES - 1] = {"ax",   "ay",    "az",  "gx",        "gy",
+                                                         "gz",   "temp",  "roll", "pitch",    "yaw",
+                                                         "gyro_roll", "gyro_pitch", "gyro_yaw"};
+      addFloatColumns(names, (int)floats.size());
+    }
+    return true;
+  }
+
+  // imu_hub --record output
+  bool openRecording(const std::string &dir, std::string &error) {
+    static const struct {
+      const char *file;
+      const char *name;
+      ColumnType type;
+      size_t size;
+    } files[] = {
+        {"time_us.i64", "time_us", COLUMN_I64, 8}, {"unit.u16", "unit", COLUMN_U16, 2},
+        {"device_us.u32", "device_us", COLUMN_U32, 4}, {"gx.f32", "gx", COLUMN_F32, 4},
+        {"gy.f32", "gy", COLUMN_F32, 4}, {"gz.f32", "gz", COLUMN_F32, 4},
+        {"ax.f32", "ax", COLUMN_F32, 4}, {"ay.f32", "ay", COLUMN_F32, 4},
+        {"az.f32", "az", COLUMN_F32, 4}, {"temp.f32", "temp", COLUMN_F32, 4},
+    };
+    for (size_t i = 0; i < sizeof(files) / sizeof(files[0]); i++) {
+      Mapping mapping;
+      if (!mapFile(dir + "/" + files[i].file, mapping, error)) return false;
+      const size_t rows = mapping.length / files[i].size;
+      // a recording cut short (no clean exit) can have ragged columns
+      rowCount = i == 0 ? rows : std::min(rowCount, rows);
+      columnList.push_back({files[i].name, files[i].type, mapping.data});
+    }
+    FILE *index = fopen((dir + "/units.csv").c_str(), "r");
+    if (index) {
+      char line[512];
+      // unit,name,samples,... - the header first
+      while (fgets(line, sizeof(line), index)) {
+        const char *comma = strchr(line, ',');
+        if (!comma || line[0] < '0' || line[0] > '9') continue;
+        const char *nameEnd = strchr(comma + 1, ',');
+        const size_t unit = strtoul(line, nullptr, 10);
+        if (unitNameList.size() <= unit) unitNameList.resize(unit + 1);
+        unitNameList[unit] = nameEnd ? std::string(comma + 1, nameEnd) : std::string(comma + 1);
+      }
+      fclose(index);
+    }
+    return true;
+  }
+
+  void close() {
+    for (const Mapping &mapping : mappings) {
+      if (mapping.data) munmap(mapping.data, mapping.length);
+    }
+    mappings.clear();
+    columnList.clear();
+    times.clear();
+    floats.clear();
+    unitNameList.clear();
+    rowCount = 0;
+  }
+
+public:
+  CaptureReader() {}
+  CaptureReader(const CaptureReader &) = delete;
+  CaptureReader &operator=(const CaptureReader &) = delete;
+  ~CaptureReader() {
+    close();
+  }
+
+  // A capture file or a recording directory. threadCount 0 uses all cores.
+  // Returns false and fills in error if it can't be read or has no samples.
+  bool open(const std::string &path, std::string &error, unsigned int threadCount = 0) {
+    close();
+    if (threadCount == 0) threadCount = std::max(1u, std::thread::hardware_concurrency());
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0) {
+      error = "cannot open " + path;
+      return false;
+    }
+    return S_ISDIR(st.st_mode) ? openRecording(path, error) : openText(path, threadCount, error);
+  }
+
+  const std::vector<CaptureColumn> &columns() const {
+    return columnList;
+  }
+
+  // samples in every column
+  size_t length() const {
+    return rowCount;
+  }
+
+  // recordings only - the name of each unit index
+  const std::vector<std::string> &unitNames() const {
+    return unitNameList;
+  }
+};
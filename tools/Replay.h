@@ -0,0 +1,112 @@
+#pragma once
+
+// Replays a capture through the firmware's IMUFusion pipeline and scores the
+// result against the capture's reference orientation.
+
+#include "Capture.h"
+#include "IMUFusion.h"
+#include <math.h>
+
+struct ReplayScore {
+  // tilt (roll/pitch) error in degrees - heading isn't observable without a
+  // magnetometer so it is left out of the score
+  double rmsTiltError = 0.0;
+  double maxTiltError = 0.0;
+  size_t scoredSamples = 0;
+};
+
+// Earth "up" expressed in the body frame for a body to earth quaternion
+static inline FusionVector bodyUp(const FusionQuaternion q) {
+  const float w = q.element.w, x = q.element.x, y = q.element.y, z = q.element.z;
+  const FusionVector up = {.axis = {
+                               .x = 2.0f * (x * z - w * y),
+                               .y = 2.0f * (y * z + w * x),
+                               .z = w * w - x * x - y * y + z * z,
+                           }};
+  return up;
+}
+
+// Angle in degrees between the tilt of two orientations
+static inline double tiltError(const FusionQuaternion a, const FusionQuaternion b) {
+  double dot = FusionVectorDotProduct(bodyUp(a), bodyUp(b));
+  if (dot > 1.0) dot = 1.0;
+  if (dot < -1.0) dot = -1.0;
+  return acos(dot) * 180.0 / M_PI;
+}
+
+// Everything fusion_tune varies: the AHRS settings, the offset correction's
+// steady state and how many input samples are averaged into each update
+struct ReplayConfig {
+  FusionAhrsSettings settings;
+  // FusionOffset cutoff (Hz) and stillness timeout (s)
+  float offsetCutoff;
+  float offsetTimeout;
+  unsigned int decimation;
+};
+
+// mean input sample rate of a capture - Hz
+static inline float captureSampleRate(const Capture &capture) {
+  if (capture.samples.size() < 2) return IMU_FUSION_SAMPLE_RATE;
+  double seconds = 0.0;
+  for (size_t i = 1; i < capture.samples.size(); i++) {
+    seconds += (uint32_t)(capture.samples[i].timeMicros - capture.samples[i - 1].timeMicros) * 1e-6;
+  }
+  return (float)((capture.samples.size() - 1) / seconds);
+}
+
+// Runs the samples through fusion, averaging each group of decimation samples
+// into one update at the time of the last, and scores every update after
+// skipSeconds against the reference
+static inline ReplayScore scoreReplay(const Capture &capture, IMUFusion &fusion, unsigned int decimation,
+                                      float skipSeconds) {
+  ReplayScore score;
+  if (capture.samples.empty()) return score;
+  fusion.lastUpdateMicros = capture.samples[0].timeMicros;
+  const uint32_t skipMicros = (uint32_t)(skipSeconds * 1e6f);
+  double sumSquares = 0.0;
+  FusionVector gyroscope = FUSION_VECTOR_ZERO;
+  FusionVector accelerometer = FUSION_VECTOR_ZERO;
+  unsigned int count = 0;
+  for (const CaptureSample &sample : capture.samples) {
+    if (decimation > 1) {
+      gyroscope = FusionVectorAdd(gyroscope, sample.gyroscope);
+      accelerometer = FusionVectorAdd(accelerometer, sample.accelerometer);
+      if (++count < decimation) continue;
+      fusion.process(FusionVectorMultiplyScalar(gyroscope, 1.0f / count),
+                     FusionVectorMultiplyScalar(accelerometer, 1.0f / count), sample.temperatureC, sample.timeMicros);
+      gyroscope = FUSION_VECTOR_ZERO;
+      accelerometer = FUSION_VECTOR_ZERO;
+      count = 0;
+    } else {
+      fusion.process(sample.gyroscope, sample.accelerometer, sample.temperatureC, sample.timeMicros);
+    }
+    if (!capture.hasReference || sample.timeMicros - capture.samples[0].timeMicros < skipMicros) {
+      continue;
+    }
+    const double error = tiltError(FusionAhrsGetQuaternion(&fusion.g_ahrs), sample.reference);
+    sumSquares += error * error;
+    if (error > score.maxTiltError) score.maxTiltError = error;
+    score.scoredSamples++;
+  }
+  if (score.scoredSamples > 0) {
+    score.rmsTiltError = sqrt(sumSquares / score.scoredSamples);
+  }
+  return score;
+}
+
+// skipSeconds excludes the AHRS initialisation period from the score. The
+// offset correction runs at the capture's own rate, as it does on the device
+static inline ReplayScore replayCapture(const Capture &capture, const FusionAhrsSettings &settings,
+                                        float skipSeconds) {
+  IMUFusion fusion(settings, (unsigned int)(captureSampleRate(capture) + 0.5f));
+  return scoreReplay(capture, fusion, 1, skipSeconds);
+}
+
+// sampleRate is the capture's input rate - Hz
+static inline ReplayScore replayCapture(const Capture &capture, const ReplayConfig &config, float sampleRate,
+                                        float skipSeconds) {
+  const unsigned int decimation = config.decimation > 0 ? config.decimation : 1;
+  IMUFusion fusion(config.settings, (unsigned int)(sampleRate / decimation + 0.5f));
+  fusion.offset.setSteadyState(config.offsetCutoff, config.offsetTimeout);
+  return scoreReplay(capture, fusion, decimation, skipSeconds);
+}
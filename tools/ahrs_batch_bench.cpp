@@ -0,0 +1,94 @@
+//
+// ahrs_batch_bench: compares AhrsBatch against one scalar FusionAhrs per
+// sensor - checks the orientations match and reports the time per update for
+// both.
+//
+// usage: ahrs_batch_bench [samples]
+//
+
+#include "AhrsBatch.h"
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+
+#define BENCH_SENSORS 8
+
+// smooth motion with a different phase per sensor and occasional shocks so
+// rejection, recovery and the gyro range reset are all exercised
+static void syntheticSample(int sensor, int i, FusionVector &gyroscope, FusionVector &accelerometer) {
+  const float t = i * 0.005f + sensor * 0.37f;
+  gyroscope = {.axis = {.x = 60.0f * sinf(1.1f * t), .y = 45.0f * cosf(0.7f * t), .z = 30.0f * sinf(0.3f * t)}};
+  const bool shock = (i + sensor * 97) % 2000 < 40;
+  if (shock && sensor == 3) gyroscope.axis.z = 2100.0f;
+  accelerometer = {.axis = {.x = 0.2f * sinf(t), .y = 0.1f * cosf(2.0f * t), .z = 0.97f}};
+  if (shock) accelerometer.axis.x += 1.5f;
+}
+
+int main(int argc, char **argv) {
+  const int samples = argc > 1 ? atoi(argv[1]) : 200000;
+  const FusionAhrsSettings settings = {
+      .convention = FusionConventionNwu,
+      .gain = 0.5f,
+      .gyroscopeRange = 2000.0f,
+      .accelerationRejection = 10.0f,
+      .magneticRejection = 0.0f,
+      .recoveryTriggerPeriod = 1000u,
+  };
+
+  // pre-generate the inputs so only the filter updates are timed
+  std::vector<FusionVector> gyroscopes((size_t)samples * BENCH_SENSORS), accelerometers(gyroscopes.size());
+  for (int i = 0; i < samples; i++) {
+    for (int s = 0; s < BENCH_SENSORS; s++) {
+      syntheticSample(s, i, gyroscopes[(size_t)i * BENCH_SENSORS + s], accelerometers[(size_t)i * BENCH_SENSORS + s]);
+    }
+  }
+
+  FusionAhrs scalar[BENCH_SENSORS];
+  for (FusionAhrs &ahrs : scalar) {
+    FusionAhrsInitialise(&ahrs);
+    FusionAhrsSetSettings(&ahrs, &settings);
+  }
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < samples; i++) {
+    for (int s = 0; s < BENCH_SENSORS; s++) {
+      const size_t k = (size_t)i * BENCH_SENSORS + s;
+      FusionAhrsUpdateNoMagnetometer(&scalar[s], gyroscopes[k], accelerometers[k], 0.005f);
+    }
+  }
+  const double scalarSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+  static AhrsBatch<BENCH_SENSORS> batch(settings);
+  start = std::chrono::steady_clock::now();
+  for (int i = 0; i < samples; i++) {
+    for (int s = 0; s < BENCH_SENSORS; s++) {
+      const size_t k = (size_t)i * BENCH_SENSORS + s;
+      batch.gx[s] = gyroscopes[k].axis.x;
+      batch.gy[s] = gyroscopes[k].axis.y;
+      batch.gz[s] = gyroscopes[k].axis.z;
+      batch.ax[s] = accelerometers[k].axis.x;
+      batch.ay[s] = accelerometers[k].axis.y;
+      batch.az[s] = accelerometers[k].axis.z;
+      batch.deltaTime[s] = 0.005f;
+    }
+    batch.update();
+  }
+  const double batchSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+  float maxDifference = 0.0f;
+  for (int s = 0; s < BENCH_SENSORS; s++) {
+    const FusionQuaternion a = FusionAhrsGetQuaternion(&scalar[s]);
+    const FusionQuaternion b = batch.getQuaternion(s);
+    for (int e = 0; e < 4; e++) {
+      maxDifference = fmaxf(maxDifference, fabsf(a.array[e] - b.array[e]));
+    }
+  }
+
+  printf("sensors: %d, samples: %d, vector width: %d\n", BENCH_SENSORS, samples, AhrsVec::width);
+  printf("scalar: %.1f ns per update of all sensors\n", scalarSeconds * 1e9 / samples);
+  printf("batch:  %.1f ns per update of all sensors (%.2fx)\n", batchSeconds * 1e9 / samples,
+         scalarSeconds / batchSeconds);
+  printf("max quaternion difference: %g\n", maxDifference);
+  // rounding differences grow slowly; anything large means the maths diverged
+  return maxDifference < 1e-3f ? 0 : 1;
+}
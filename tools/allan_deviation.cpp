@@ -0,0 +1,246 @@
+//
+// allan_deviation: overlapping Allan deviation of long stationary raw captures
+// (recorded with the ALLAN command - one capture per unit), computed for each
+// axis on all CPU cores, with the angle random walk and bias instability read
+// off each curve.
+//
+// usage: allan_deviation [options] capture.csv [capture.csv ...]
+//   --accel          also analyse the accelerometer axes
+//   --curve FILE     write every curve as CSV (capture,sensor,axis,tau_s,adev)
+//   --points N       averaging times per decade (default 10)
+//   -j N             worker threads (default: all cores)
+//
+
+#include "Capture.h"
+#include <algorithm>
+#include <atomic>
+#include <math.h>
+#include <stdio.h>
+#include <thread>
+
+// flicker floor of the Allan deviation is sqrt(2 ln2 / pi) times the bias
+// instability
+#define BIAS_INSTABILITY_FACTOR 0.664
+// the longest averaging time still spans this many independent clusters -
+// beyond that the estimate is too noisy to find the minimum in
+#define MIN_CLUSTERS 10
+
+// one axis of one capture
+struct Channel {
+  size_t capture;
+  // 0 gyro, 1 accel
+  int sensor;
+  int axis;
+  double mean;
+  // running integral of the rate with the mean taken out - the Allan
+  // variance ignores a constant so this only keeps the sums well conditioned
+  std::vector<double> integral;
+  std::vector<double> adev;
+};
+
+struct CaptureInfo {
+  // sample interval - seconds
+  double tau0;
+  // intervals more than 1.5 sample periods long
+  size_t gaps;
+  float minTemperature;
+  float maxTemperature;
+  // cluster sizes (in samples) the curves are evaluated at
+  std::vector<size_t> clusters;
+};
+
+// overlapping Allan deviation for clusters of m samples
+static double overlappingAdev(const std::vector<double> &integral, size_t m, double tau0) {
+  const size_t n = integral.size() - 1;
+  double sum = 0.0;
+  for (size_t k = 0; k + 2 * m <= n; k++) {
+    const double d = integral[k + 2 * m] - 2.0 * integral[k + m] + integral[k];
+    sum += d * d;
+  }
+  const double tau = m * tau0;
+  return sqrt(sum / (2.0 * tau * tau * (n - 2 * m + 1)));
+}
+
+// log spaced cluster sizes from 1 up to a tenth of the capture
+static std::vector<size_t> clusterSizes(size_t samples, int pointsPerDecade) {
+  std::vector<size_t> sizes;
+  for (int i = 0;; i++) {
+    const size_t m = (size_t)llround(pow(10.0, (double)i / pointsPerDecade));
+    if (m * MIN_CLUSTERS > samples) break;
+    if (sizes.empty() || m != sizes.back()) sizes.push_back(m);
+  }
+  return sizes;
+}
+
+static void usage() {
+  fprintf(stderr, "usage: allan_deviation [--accel] [--curve FILE] [--points N] [-j N] capture.csv...\n");
+}
+
+int main(int argc, char **argv) {
+  bool accel = false;
+  const char *curvePath = nullptr;
+  int pointsPerDecade = 10;
+  unsigned int threadCount = std::max(1u, std::thread::hardware_concurrency());
+  std::vector<std::string> paths;
+
+  for (int i = 1; i < argc; i++) {
+    const std::string arg = argv[i];
+    const bool hasValue = i + 1 < argc;
+    bool ok = true;
+    if (arg == "--accel") {
+      accel = true;
+    } else if (arg == "--curve" && hasValue) {
+      curvePath = argv[++i];
+    } else if (arg == "--points" && hasValue) {
+      pointsPerDecade = atoi(argv[++i]);
+      ok = pointsPerDecade > 0;
+    } else if (arg == "-j" && hasValue) {
+      threadCount = std::max(1ul, strtoul(argv[++i], nullptr, 10));
+    } else if (arg[0] == '-') {
+      ok = false;
+    } else {
+      paths.push_back(arg);
+    }
+    if (!ok) {
+      fprintf(stderr, "bad argument: %s\n", arg.c_str());
+      usage();
+      return 1;
+    }
+  }
+  if (paths.empty()) {
+    usage();
+    return 1;
+  }
+
+  // load each capture, keep just the integrated channels and let the
+  // samples go - multi-hour captures are large
+  std::vector<CaptureInfo> infos(paths.size());
+  std::vector<Channel> channels;
+  for (size_t c = 0; c < paths.size(); c++) {
+    Capture capture;
+    std::string error;
+    if (!loadCapture(paths[c], capture, error)) {
+      fprintf(stderr, "%s\n", error.c_str());
+      return 1;
+    }
+    const std::vector<CaptureSample> &samples = capture.samples;
+    if (samples.size() < 16) {
+      fprintf(stderr, "%s is too short\n", paths[c].c_str());
+      return 1;
+    }
+    CaptureInfo &info = infos[c];
+    // unsigned differences so micros() wrapping (every 71 minutes) is harmless
+    double duration = 0.0;
+    for (size_t i = 1; i < samples.size(); i++) {
+      duration += (uint32_t)(samples[i].timeMicros - samples[i - 1].timeMicros) * 1e-6;
+    }
+    info.tau0 = duration / (samples.size() - 1);
+    info.gaps = 0;
+    info.minTemperature = info.maxTemperature = samples[0].temperatureC;
+    for (size_t i = 1; i < samples.size(); i++) {
+      const double dt = (uint32_t)(samples[i].timeMicros - samples[i - 1].timeMicros) * 1e-6;
+      if (dt > 1.5 * info.tau0) info.gaps++;
+      info.minTemperature = std::min(info.minTemperature, samples[i].temperatureC);
+      info.maxTemperature = std::max(info.maxTemperature, samples[i].temperatureC);
+    }
+    if (info.gaps > 0) {
+      fprintf(stderr, "%s: %zu gaps in the samples - the curve assumes they're contiguous\n", paths[c].c_str(),
+              info.gaps);
+    }
+    info.clusters = clusterSizes(samples.size(), pointsPerDecade);
+
+    for (int sensor = 0; sensor < (accel ? 2 : 1); sensor++) {
+      for (int axis = 0; axis < 3; axis++) {
+        Channel channel;
+        channel.capture = c;
+        channel.sensor = sensor;
+        channel.axis = axis;
+        double sum = 0.0;
+        for (const CaptureSample &sample : samples) {
+          sum += (sensor == 0 ? sample.gyroscope : sample.accelerometer).array[axis];
+        }
+        channel.mean = sum / samples.size();
+        channel.integral.resize(samples.size() + 1);
+        channel.integral[0] = 0.0;
+        for (size_t i = 0; i < samples.size(); i++) {
+          const double value = (sensor == 0 ? samples[i].gyroscope : samples[i].accelerometer).array[axis];
+          channel.integral[i + 1] = channel.integral[i] + (value - channel.mean) * info.tau0;
+        }
+        channel.adev.resize(info.clusters.size());
+        channels.push_back(std::move(channel));
+      }
+    }
+  }
+
+  // one job per point on each curve - each worker pulls the next until done
+  std::vector<std::pair<size_t, size_t>> jobs;
+  for (size_t i = 0; i < channels.size(); i++) {
+    for (size_t j = 0; j < channels[i].adev.size(); j++) jobs.push_back({i, j});
+  }
+  std::atomic<size_t> next(0);
+  auto worker = [&]() {
+    for (size_t i = next++; i < jobs.size(); i = next++) {
+      Channel &channel = channels[jobs[i].first];
+      const CaptureInfo &info = infos[channel.capture];
+      const size_t point = jobs[i].second;
+      channel.adev[point] = overlappingAdev(channel.integral, info.clusters[point], info.tau0);
+    }
+  };
+  std::vector<std::thread> workers;
+  for (unsigned int i = 0; i < std::min<size_t>(threadCount, jobs.size()); i++) {
+    workers.emplace_back(worker);
+  }
+  for (std::thread &t : workers) t.join();
+
+  static const char *const sensorNames[2] = {"gyro", "accel"};
+  static const char *const axisNames[3] = {"x", "y", "z"};
+  if (curvePath) {
+    FILE *curve = fopen(curvePath, "w");
+    if (!curve) {
+      fprintf(stderr, "cannot open %s\n", curvePath);
+      return 1;
+    }
+    fprintf(curve, "capture,sensor,axis,tau_s,adev\n");
+    for (const Channel &channel : channels) {
+      const CaptureInfo &info = infos[channel.capture];
+      for (size_t j = 0; j < channel.adev.size(); j++) {
+        fprintf(curve, "%s,%s,%s,%g,%.6g\n", paths[channel.capture].c_str(), sensorNames[channel.sensor],
+                axisNames[channel.axis], info.clusters[j] * info.tau0, channel.adev[j]);
+      }
+    }
+    fclose(curve);
+  }
+
+  // Random walk is read off the slope -1/2 part of the curve at tau = 1 s,
+  // bias instability from the flat bottom. Gyro figures are in deg/sqrt(h)
+  // and deg/h, accel ones in m/s/sqrt(h) and mg.
+  printf("capture,sensor,axis,rate_hz,hours,temp_min,temp_max,mean,random_walk,bias_instability,bias_tau_s,"
+         "bias_converged\n");
+  for (const Channel &channel : channels) {
+    const CaptureInfo &info = infos[channel.capture];
+    const std::vector<double> &adev = channel.adev;
+    const size_t minimum = std::min_element(adev.begin(), adev.end()) - adev.begin();
+    // segment whose log-log slope is nearest -1/2, before the minimum
+    size_t white = 0;
+    double bestSlope = INFINITY;
+    for (size_t j = 0; j + 1 <= minimum && j + 1 < adev.size(); j++) {
+      const double slope = log(adev[j + 1] / adev[j]) / log((double)info.clusters[j + 1] / info.clusters[j]);
+      if (fabs(slope + 0.5) < bestSlope) {
+        bestSlope = fabs(slope + 0.5);
+        white = j;
+      }
+    }
+    const double randomWalk = adev[white] * sqrt(info.clusters[white] * info.tau0);
+    const double biasInstability = adev[minimum] / BIAS_INSTABILITY_FACTOR;
+    const double hours = (channel.integral.size() - 1) * info.tau0 / 3600.0;
+    // a minimum at the longest tau means the curve was still falling
+    const bool converged = minimum + 1 < adev.size();
+    const bool gyro = channel.sensor == 0;
+    printf("%s,%s,%s,%.2f,%.3f,%.1f,%.1f,%.6g,%.6g,%.6g,%g,%s\n", paths[channel.capture].c_str(),
+           sensorNames[channel.sensor], axisNames[channel.axis], 1.0 / info.tau0, hours, info.minTemperature,
+           info.maxTemperature, channel.mean, gyro ? randomWalk * 60.0 : randomWalk * 9.80665 * 60.0,
+           gyro ? biasInstability * 3600.0 : biasInstability * 1000.0, info.clusters[minimum] * info.tau0,
+           converged ? "true" : "false");
+  }
+  return 0;
+}
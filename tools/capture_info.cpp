@@ -0,0 +1,80 @@
+//
+// capture_info: load captures or imu_hub recordings with CaptureReader (the
+// loader behind the imu_capture Python module) and print what's in them and
+// how long the load took.
+//
+// usage: capture_info [options] capture.csv|recording_dir [...]
+//   -j N             threads parsing each text capture (default: all cores)
+//
+
+#include "CaptureReader.h"
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+
+static const char *typeName(ColumnType type) {
+  switch (type) {
+  case COLUMN_F32:
+    return "f32";
+  case COLUMN_I64:
+    return "i64";
+  case COLUMN_U32:
+    return "u32";
+  case COLUMN_U16:
+    return "u16";
+  }
+  return "?";
+}
+
+static void usage() {
+  fprintf(stderr, "usage: capture_info [-j N] capture.csv|recording_dir...\n");
+}
+
+int main(int argc, char **argv) {
+  unsigned int threadCount = 0;
+  std::vector<std::string> paths;
+
+  for (int i = 1; i < argc; i++) {
+    const std::string arg = argv[i];
+    const bool hasValue = i + 1 < argc;
+    bool ok = true;
+    if (arg == "-j" && hasValue) {
+      threadCount = std::max(1ul, strtoul(argv[++i], nullptr, 10));
+    } else if (arg[0] == '-') {
+      ok = false;
+    } else {
+      paths.push_back(arg);
+    }
+    if (!ok) {
+      fprintf(stderr, "bad argument: %s\n", arg.c_str());
+      usage();
+      return 1;
+    }
+  }
+  if (paths.empty()) {
+    usage();
+    return 1;
+  }
+
+  for (const std::string &path : paths) {
+    CaptureReader reader;
+    std::string error;
+    const auto start = std::chrono::steady_clock::now();
+    if (!reader.open(path, error, threadCount)) {
+      fprintf(stderr, "%s\n", error.c_str());
+      return 1;
+    }
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    const int64_t *time = (const int64_t *)reader.columns()[0].data;
+    const size_t length = reader.length();
+    printf("%s: %zu samples, %.1f s of data, loaded in %.3f s\n", path.c_str(), length,
+           length > 1 ? (time[length - 1] - time[0]) * 1e-6 : 0.0, seconds);
+    for (const CaptureColumn &column : reader.columns()) {
+      printf("  %-12s %s\n", column.name.c_str(), typeName(column.type));
+    }
+    for (size_t unit = 0; unit < reader.unitNames().size(); unit++) {
+      printf("  unit %zu: %s\n", unit, reader.unitNames()[unit].c_str());
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,290 @@
+//
+// fusion_golden: golden-output regression check for the fusion pipeline.
+//
+// Every capture (*.csv) in the golden directory is replayed through IMUFusion
+// and each output channel is compared against the stored expected output
+// (*.expected) with a per-channel tolerance. Throughput is reported for each
+// capture so performance refactors can be compared too.
+//
+// usage: fusion_golden [--update] [--generate] [--repeat N] DIR
+//   --generate   (re)write the synthetic input captures into DIR
+//   --update     (re)write the expected outputs from the current code
+//   --repeat N   replays per capture when measuring throughput (default 20)
+//
+// Exits with 1 if any channel deviates by more than its tolerance.
+//
+
+#include "Capture.h"
+#include "Replay.h"
+#include <algorithm>
+#include <chrono>
+#include <dirent.h>
+#include <stdio.h>
+
+#define CHANNEL_COUNT 9
+
+struct Channel {
+  const char *name;
+  float tolerance;
+  // wrap differences into -180..180
+  bool isAngle;
+};
+
+static const Channel channels[CHANNEL_COUNT] = {
+    {"gx", 0.01f, false},       {"gy", 0.01f, false},         {"gz", 0.01f, false},
+    {"roll", 0.1f, true},       {"pitch", 0.1f, true},        {"yaw", 0.1f, true},
+    {"gyroRoll", 0.1f, true},   {"gyroPitch", 0.1f, true},    {"gyroYaw", 0.1f, true},
+};
+
+struct OutputSample {
+  uint32_t timeMicros;
+  float values[CHANNEL_COUNT];
+};
+
+static void replay(const Capture &capture, std::vector<OutputSample> &outputs) {
+  IMUFusion fusion;
+  fusion.lastUpdateMicros = capture.samples[0].timeMicros;
+  outputs.resize(capture.samples.size());
+  for (size_t i = 0; i < capture.samples.size(); i++) {
+    const CaptureSample &sample = capture.samples[i];
+    fusion.process(sample.gyroscope, sample.accelerometer, sample.temperatureC, sample.timeMicros);
+    const IMUData data = fusion.getData();
+    OutputSample &output = outputs[i];
+    output.timeMicros = data.timeMicros;
+    output.values[0] = data.gx;
+    output.values[1] = data.gy;
+    output.values[2] = data.gz;
+    output.values[3] = data.fusionRoll;
+    output.values[4] = data.fusionPitch;
+    output.values[5] = data.fusionYaw;
+    output.values[6] = data.accumulatedGyroX;
+    output.values[7] = data.accumulatedGyroY;
+    output.values[8] = data.accumulatedGyroZ;
+  }
+}
+
+static bool writeExpected(const std::string &path, const std::vector<OutputSample> &outputs) {
+  FILE *file = fopen(path.c_str(), "w");
+  if (!file) return false;
+  fprintf(file, "time_us");
+  for (const Channel &channel : channels) fprintf(file, ",%s", channel.name);
+  fprintf(file, "\n");
+  for (const OutputSample &output : outputs) {
+    fprintf(file, "%u", output.timeMicros);
+    for (float v : output.values) fprintf(file, ",%.5f", v);
+    fprintf(file, "\n");
+  }
+  return fclose(file) == 0;
+}
+
+static bool readExpected(const std::string &path, std::vector<OutputSample> &outputs) {
+  FILE *file = fopen(path.c_str(), "r");
+  if (!file) return false;
+  char line[512];
+  outputs.clear();
+  while (fgets(line, sizeof(line), file)) {
+    if (line[0] < '0' || line[0] > '9') continue;
+    OutputSample output;
+    char *p = line;
+    output.timeMicros = (uint32_t)strtoul(p, &p, 10);
+    for (float &v : output.values) {
+      if (*p == ',') p++;
+      v = strtof(p, &p);
+    }
+    outputs.push_back(output);
+  }
+  fclose(file);
+  return true;
+}
+
+//------------------------------------------------------------------------------
+// Synthetic captures. A small deterministic generator so the inputs can be
+// regenerated bit for bit; replace or extend them with real recordings.
+
+struct Lcg {
+  uint32_t state;
+  float uniform() {
+    state = state * 1664525u + 1013904223u;
+    return (state >> 8) * (1.0f / 16777216.0f);
+  }
+  // approximate unit gaussian (Irwin-Hall)
+  float gaussian() {
+    float sum = 0.0f;
+    for (int i = 0; i < 12; i++) sum += uniform();
+    return sum - 6.0f;
+  }
+};
+
+// angular rate in deg/s and linear acceleration in g at time t for a scenario
+typedef void (*MotionProfile)(float t, FusionVector &rate, FusionVector &linear);
+
+static void stationaryMotion(float, FusionVector &rate, FusionVector &linear) {
+  rate = FUSION_VECTOR_ZERO;
+  linear = FUSION_VECTOR_ZERO;
+}
+
+static void tiltingMotion(float t, FusionVector &rate, FusionVector &linear) {
+  rate = {.axis = {.x = 40.0f * sinf(1.3f * t), .y = 30.0f * sinf(0.9f * t + 1.0f), .z = 20.0f * cosf(0.5f * t)}};
+  linear = FUSION_VECTOR_ZERO;
+}
+
+static void vibrationMotion(float t, FusionVector &rate, FusionVector &linear) {
+  rate = {.axis = {.x = 5.0f * sinf(2.0f * t), .y = 0.0f, .z = 0.0f}};
+  // bursts of strong shaking between 3-5 s and 7-8 s
+  const bool shaking = (t > 3.0f && t < 5.0f) || (t > 7.0f && t < 8.0f);
+  const float a = shaking ? 1.5f : 0.0f;
+  linear = {.axis = {.x = a * sinf(60.0f * t), .y = a * cosf(45.0f * t), .z = 0.5f * a * sinf(80.0f * t)}};
+}
+
+static bool generateCapture(const std::string &path, MotionProfile motion, float seconds, FusionVector bias,
+                            uint32_t seed) {
+  FILE *file = fopen(path.c_str(), "w");
+  if (!file) return false;
+  Lcg lcg = {seed};
+  const uint32_t periodMicros = 10000; // 100 Hz, the STREAM_RAW rate
+  const float dt = periodMicros / 1e6f;
+  FusionQuaternion q = FUSION_IDENTITY_QUATERNION;
+  fprintf(file, "time_us,gx,gy,gz,ax,ay,az,temp,qw,qx,qy,qz\n");
+  for (uint32_t i = 0; i * dt < seconds; i++) {
+    const float t = i * dt;
+    FusionVector rate, linear;
+    motion(t, rate, linear);
+    // integrate the true orientation with the body rate
+    const FusionVector halfRate = FusionVectorMultiplyScalar(rate, 0.5f * FusionDegreesToRadians(1.0f) * dt);
+    q = FusionQuaternionNormalise(FusionQuaternionAdd(q, FusionQuaternionMultiplyVector(q, halfRate)));
+    const FusionVector accel = FusionVectorAdd(bodyUp(q), linear);
+    fprintf(file, "%u,%.4f,%.4f,%.4f,%.5f,%.5f,%.5f,%.2f,%.6f,%.6f,%.6f,%.6f\n", 1000000u + i * periodMicros,
+            rate.axis.x + bias.axis.x + 0.1f * lcg.gaussian(), rate.axis.y + bias.axis.y + 0.1f * lcg.gaussian(),
+            rate.axis.z + bias.axis.z + 0.1f * lcg.gaussian(), accel.axis.x + 0.005f * lcg.gaussian(),
+            accel.axis.y + 0.005f * lcg.gaussian(), accel.axis.z + 0.005f * lcg.gaussian(), 25.0f + 0.01f * t,
+            q.element.w, q.element.x, q.element.y, q.element.z);
+  }
+  return fclose(file) == 0;
+}
+
+static bool generateCaptures(const std::string &dir) {
+  const FusionVector bias = {.axis = {.x = 0.8f, .y = -0.5f, .z = 0.3f}};
+  return generateCapture(dir + "/stationary_bias.csv", stationaryMotion, 15.0f, bias, 1) &&
+         generateCapture(dir + "/tilting.csv", tiltingMotion, 10.0f, bias, 2) &&
+         generateCapture(dir + "/vibration.csv", vibrationMotion, 10.0f, bias, 3);
+}
+
+//------------------------------------------------------------------------------
+
+static std::vector<std::string> listCaptures(const std::string &dir) {
+  std::vector<std::string> paths;
+  DIR *d = opendir(dir.c_str());
+  if (!d) return paths;
+  while (struct dirent *entry = readdir(d)) {
+    const std::string name = entry->d_name;
+    if (name.size() > 4 && name.compare(name.size() - 4, 4, ".csv") == 0) {
+      paths.push_back(dir + "/" + name);
+    }
+  }
+  closedir(d);
+  std::sort(paths.begin(), paths.end());
+  return paths;
+}
+
+static std::string expectedPath(const std::string &capturePath) {
+  return capturePath.substr(0, capturePath.size() - 4) + ".expected";
+}
+
+int main(int argc, char **argv) {
+  bool update = false;
+  bool generate = false;
+  int repeat = 20;
+  std::string dir;
+  for (int i = 1; i < argc; i++) {
+    const std::string arg = argv[i];
+    if (arg == "--update") {
+      update = true;
+    } else if (arg == "--generate") {
+      generate = true;
+    } else if (arg == "--repeat" && i + 1 < argc) {
+      repeat = std::max(1, atoi(argv[++i]));
+    } else if (arg[0] != '-' && dir.empty()) {
+      dir = arg;
+    } else {
+      fprintf(stderr, "usage: fusion_golden [--update] [--generate] [--repeat N] DIR\n");
+      return 1;
+    }
+  }
+  if (dir.empty()) {
+    fprintf(stderr, "usage: fusion_golden [--update] [--generate] [--repeat N] DIR\n");
+    return 1;
+  }
+
+  if (generate && !generateCaptures(dir)) {
+    fprintf(stderr, "failed to write synthetic captures to %s\n", dir.c_str());
+    return 1;
+  }
+
+  const std::vector<std::string> paths = listCaptures(dir);
+  if (paths.empty()) {
+    fprintf(stderr, "no captures in %s\n", dir.c_str());
+    return 1;
+  }
+
+  bool passed = true;
+  for (const std::string &path : paths) {
+    Capture capture;
+    std::string error;
+    if (!loadCapture(path, capture, error)) {
+      fprintf(stderr, "%s\n", error.c_str());
+      return 1;
+    }
+
+    std::vector<OutputSample> outputs;
+    const auto start = std::chrono::steady_clock::now();
+    for (int r = 0; r < repeat; r++) replay(capture, outputs);
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    const double nsPerSample = seconds * 1e9 / ((double)repeat * capture.samples.size());
+    printf("%s: %zu samples, %.1f ns/sample, %.2f Msamples/s\n", path.c_str(), capture.samples.size(),
+           nsPerSample, 1e3 / nsPerSample);
+
+    if (update) {
+      if (!writeExpected(expectedPath(path), outputs)) {
+        fprintf(stderr, "failed to write %s\n", expectedPath(path).c_str());
+        return 1;
+      }
+      continue;
+    }
+
+    std::vector<OutputSample> expected;
+    if (!readExpected(expectedPath(path), expected)) {
+      fprintf(stderr, "  missing %s (run with --update)\n", expectedPath(path).c_str());
+      passed = false;
+      continue;
+    }
+    if (expected.size() != outputs.size()) {
+      printf("  FAIL sample count %zu, expected %zu\n", outputs.size(), expected.size());
+      passed = false;
+      continue;
+    }
+    for (int c = 0; c < CHANNEL_COUNT; c++) {
+      float maxDeviation = 0.0f;
+      size_t worst = 0;
+      for (size_t i = 0; i < outputs.size(); i++) {
+        float deviation = outputs[i].values[c] - expected[i].values[c];
+        if (channels[c].isAngle) deviation = remainderf(deviation, 360.0f);
+        deviation = fabsf(deviation);
+        if (isnan(deviation)) {
+          maxDeviation = INFINITY;
+          worst = i;
+          break;
+        }
+        if (deviation > maxDeviation) {
+          maxDeviation = deviation;
+          worst = i;
+        }
+      }
+      const bool ok = maxDeviation <= channels[c].tolerance;
+      passed = passed && ok;
+      printf("  %-4s %-9s max deviation %.5f (tolerance %.5f) at t=%u\n", ok ? "ok" : "FAIL", channels[c].name,
+             maxDeviation, channels[c].tolerance, outputs[worst].timeMicros);
+    }
+  }
+  if (!update) printf(passed ? "PASSED\n" : "FAILED\n");
+  return passed ? 0 : 1;
+}
@@ -0,0 +1,161 @@
+//
+// fusion_sweep: replay raw captures through the Fusion AHRS with a grid of
+// FusionAhrsSettings on all CPU cores and rank the settings by how closely the
+// fused orientation tracks the capture's reference orientation.
+//
+// usage: fusion_sweep [options] capture.csv [capture.csv ...]
+//   --gain LIST         e.g. 0.1:1.0:0.1 (start:stop:step) or 0.25,0.5,1
+//   --rejection LIST    accelerationRejection in degrees
+//   --recovery LIST     recoveryTriggerPeriod in samples (default: the device's
+//                       at the first capture's sample rate)
+//   --skip SECONDS      ignore the start of each capture (default 3)
+//   --top N             only print the best N results (default all)
+//   -j N                worker threads (default: all cores)
+//
+
+#include "Capture.h"
+#include "Replay.h"
+#include <algorithm>
+#include <atomic>
+#include <stdio.h>
+#include <thread>
+
+struct SweepResult {
+  FusionAhrsSettings settings;
+  // averaged over all captures
+  double rmsTiltError;
+  double maxTiltError;
+};
+
+// Parses "start:stop:step" or a comma separated list
+static bool parseList(const char *text, std::vector<float> &values) {
+  values.clear();
+  float start, stop, step;
+  if (sscanf(text, "%f:%f:%f", &start, &stop, &step) == 3) {
+    if (step <= 0.0f || stop < start) return false;
+    // nudge stop so accumulated rounding doesn't drop the last value
+    for (int i = 0; start + i * step <= stop + step * 1e-3f; i++) {
+      values.push_back(start + i * step);
+    }
+    return true;
+  }
+  const char *p = text;
+  while (*p) {
+    char *end;
+    const float v = strtof(p, &end);
+    if (end == p) return false;
+    values.push_back(v);
+    p = *end == ',' ? end + 1 : end;
+  }
+  return !values.empty();
+}
+
+static void usage() {
+  fprintf(stderr, "usage: fusion_sweep [--gain LIST] [--rejection LIST] [--recovery LIST]\n"
+                  "                    [--skip SECONDS] [--top N] [-j N] capture.csv...\n"
+                  "LIST is start:stop:step or a comma separated list\n");
+}
+
+int main(int argc, char **argv) {
+  const FusionAhrsSettings defaults = IMUFusion::defaultSettings();
+  std::vector<float> gains = {defaults.gain};
+  std::vector<float> rejections = {defaults.accelerationRejection};
+  std::vector<float> recoveries;
+  float skipSeconds = 3.0f;
+  size_t top = 0;
+  unsigned int threadCount = std::max(1u, std::thread::hardware_concurrency());
+  std::vector<std::string> paths;
+
+  for (int i = 1; i < argc; i++) {
+    const std::string arg = argv[i];
+    const bool hasValue = i + 1 < argc;
+    bool ok = true;
+    if (arg == "--gain" && hasValue) {
+      ok = parseList(argv[++i], gains);
+    } else if (arg == "--rejection" && hasValue) {
+      ok = parseList(argv[++i], rejections);
+    } else if (arg == "--recovery" && hasValue) {
+      ok = parseList(argv[++i], recoveries);
+    } else if (arg == "--skip" && hasValue) {
+      skipSeconds = strtof(argv[++i], nullptr);
+    } else if (arg == "--top" && hasValue) {
+      top = strtoul(argv[++i], nullptr, 10);
+    } else if (arg == "-j" && hasValue) {
+      threadCount = std::max(1ul, strtoul(argv[++i], nullptr, 10));
+    } else if (arg[0] == '-') {
+      ok = false;
+    } else {
+      paths.push_back(arg);
+    }
+    if (!ok) {
+      fprintf(stderr, "bad argument: %s\n", arg.c_str());
+      usage();
+      return 1;
+    }
+  }
+  if (paths.empty()) {
+    usage();
+    return 1;
+  }
+
+  std::vector<Capture> captures(paths.size());
+  for (size_t i = 0; i < paths.size(); i++) {
+    std::string error;
+    if (!loadCapture(paths[i], captures[i], error)) {
+      fprintf(stderr, "%s\n", error.c_str());
+      return 1;
+    }
+    if (!captures[i].hasReference) {
+      fprintf(stderr, "%s has no reference orientation (qw,qx,qy,qz columns) to score against\n",
+              paths[i].c_str());
+      return 1;
+    }
+  }
+  if (recoveries.empty()) {
+    recoveries.push_back((float)IMUFusion::defaultSettings((unsigned int)(captureSampleRate(captures[0]) + 0.5f)).recoveryTriggerPeriod);
+  }
+
+  std::vector<SweepResult> results;
+  for (float gain : gains) {
+    for (float rejection : rejections) {
+      for (float recovery : recoveries) {
+        SweepResult result = {};
+        result.settings = defaults;
+        result.settings.gain = gain;
+        result.settings.accelerationRejection = rejection;
+        result.settings.recoveryTriggerPeriod = (unsigned int)(recovery + 0.5f);
+        results.push_back(result);
+      }
+    }
+  }
+
+  // each worker pulls the next settings combination until the grid is done
+  std::atomic<size_t> next(0);
+  auto worker = [&]() {
+    for (size_t i = next++; i < results.size(); i = next++) {
+      SweepResult &result = results[i];
+      for (const Capture &capture : captures) {
+        const ReplayScore score = replayCapture(capture, result.settings, skipSeconds);
+        result.rmsTiltError += score.rmsTiltError / captures.size();
+        result.maxTiltError += score.maxTiltError / captures.size();
+      }
+    }
+  };
+  std::vector<std::thread> workers;
+  for (unsigned int i = 0; i < std::min<size_t>(threadCount, results.size()); i++) {
+    workers.emplace_back(worker);
+  }
+  for (std::thread &t : workers) t.join();
+
+  std::sort(results.begin(), results.end(), [](const SweepResult &a, const SweepResult &b) {
+    return a.rmsTiltError < b.rmsTiltError;
+  });
+  if (top > 0 && top < results.size()) results.resize(top);
+
+  printf("gain,accelerationRejection,recoveryTriggerPeriod,rmsTiltDeg,maxTiltDeg\n");
+  for (const SweepResult &result : results) {
+    printf("%g,%g,%u,%.4f,%.4f\n", result.settings.gain, result.settings.accelerationRejection,
+           result.settings.recoveryTriggerPeriod, result.rmsTiltError, result.maxTiltError);
+  }
+  return 0;
+}
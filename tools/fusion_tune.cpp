@@ -0,0 +1,303 @@
+//
+// fusion_tune: search the AHRS settings (gain, accelerationRejection,
+// recoveryTriggerPeriod) and the gyro offset correction's cutoff and timeout
+// for the values that best track the reference orientation of a set of
+// captures, at each of several update rates, and report the accuracy against
+// the CPU time each rate costs.
+//
+// usage: fusion_tune [options] capture.csv [capture.csv ...]
+//   --decimation LIST    input samples averaged per update (default 1,2,4)
+//   --population N       candidates per generation (default 64)
+//   --generations N      generations per decimation (default 12)
+//   --seed N             random seed (default 1)
+//   --skip SECONDS       ignore the start of each capture (default 3)
+//   -j N                 worker threads (default: all cores)
+//
+// The captures should all be at the same sample rate - updateHz in the output
+// is their mean rate divided by the decimation.
+//
+// The search is the cross-entropy method: each generation samples candidates
+// from a normal distribution over the log of every parameter, replays them
+// all in parallel, and refits the distribution to the best fifth.
+//
+
+#include "Capture.h"
+#include "Replay.h"
+#include <algorithm>
+#include <atomic>
+#include <math.h>
+#include <random>
+#include <stdio.h>
+#include <thread>
+#include <time.h>
+
+#define PARAMETER_COUNT 5
+// fraction of each generation the distribution is refitted to
+#define ELITE_FRACTION 0.2
+// the spread never shrinks below this (natural log units) so the search
+// doesn't collapse onto one point too early
+#define MIN_SPREAD 0.02
+
+struct Parameter {
+  const char *name;
+  double min;
+  double max;
+};
+
+// searched on a log scale; recovery is in seconds so it means the same at
+// every update rate
+static const Parameter parameters[PARAMETER_COUNT] = {
+    {"gain", 0.05, 5.0},
+    {"accelerationRejection", 1.0, 90.0},
+    {"recoverySeconds", 0.1, 30.0},
+    {"offsetCutoffHz", 0.002, 0.5},
+    {"offsetTimeoutS", 0.5, 20.0},
+};
+
+struct Candidate {
+  double values[PARAMETER_COUNT];
+  // averaged over all captures
+  double rmsTiltError;
+  double maxTiltError;
+};
+
+struct TuneResult {
+  unsigned int decimation;
+  Candidate best;
+  // host CPU time per second of captured data - microseconds
+  double cpuMicrosPerSecond;
+  // AHRS update rate, averaged over the captures - Hz
+  double updateRate;
+};
+
+static ReplayConfig toConfig(const double values[PARAMETER_COUNT], unsigned int decimation, float updateRate) {
+  ReplayConfig config;
+  config.settings = IMUFusion::defaultSettings();
+  config.settings.gain = (float)values[0];
+  config.settings.accelerationRejection = (float)values[1];
+  config.settings.recoveryTriggerPeriod = (unsigned int)(values[2] * updateRate + 0.5);
+  config.offsetCutoff = (float)values[3];
+  config.offsetTimeout = (float)values[4];
+  config.decimation = decimation;
+  return config;
+}
+
+static void evaluate(Candidate &candidate, const std::vector<Capture> &captures, const std::vector<float> &rates,
+                     unsigned int decimation, float skipSeconds) {
+  candidate.rmsTiltError = 0.0;
+  candidate.maxTiltError = 0.0;
+  for (size_t i = 0; i < captures.size(); i++) {
+    const ReplayConfig config = toConfig(candidate.values, decimation, rates[i] / decimation);
+    const ReplayScore score = replayCapture(captures[i], config, rates[i], skipSeconds);
+    candidate.rmsTiltError += score.rmsTiltError / captures.size();
+    candidate.maxTiltError += score.maxTiltError / captures.size();
+  }
+}
+
+static double threadCpuSeconds() {
+  timespec ts;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Parses a comma separated list of positive integers
+static bool parseIntegers(const char *text, std::vector<unsigned int> &values) {
+  values.clear();
+  const char *p = text;
+  while (*p) {
+    char *end;
+    const unsigned long v = strtoul(p, &end, 10);
+    if (end == p || v == 0) return false;
+    values.push_back((unsigned int)v);
+    p = *end == ',' ? end + 1 : end;
+  }
+  return !values.empty();
+}
+
+static void usage() {
+  fprintf(stderr, "usage: fusion_tune [--decimation LIST] [--population N] [--generations N] [--seed N]\n"
+                  "                   [--skip SECONDS] [-j N] capture.csv...\n");
+}
+
+int main(int argc, char **argv) {
+  std::vector<unsigned int> decimations = {1, 2, 4};
+  size_t population = 64;
+  int generations = 12;
+  unsigned long seed = 1;
+  float skipSeconds = 3.0f;
+  unsigned int threadCount = std::max(1u, std::thread::hardware_concurrency());
+  std::vector<std::string> paths;
+
+  for (int i = 1; i < argc; i++) {
+    const std::string arg = argv[i];
+    const bool hasValue = i + 1 < argc;
+    bool ok = true;
+    if (arg == "--decimation" && hasValue) {
+      ok = parseIntegers(argv[++i], decimations);
+    } else if (arg == "--population" && hasValue) {
+      population = strtoul(argv[++i], nullptr, 10);
+      ok = population >= 5;
+    } else if (arg == "--generations" && hasValue) {
+      generations = atoi(argv[++i]);
+      ok = generations > 0;
+    } else if (arg == "--seed" && hasValue) {
+      seed = strtoul(argv[++i], nullptr, 10);
+    } else if (arg == "--skip" && hasValue) {
+      skipSeconds = strtof(argv[++i], nullptr);
+    } else if (arg == "-j" && hasValue) {
+      threadCount = std::max(1ul, strtoul(argv[++i], nullptr, 10));
+    } else if (arg[0] == '-') {
+      ok = false;
+    } else {
+      paths.push_back(arg);
+    }
+    if (!ok) {
+      fprintf(stderr, "bad argument: %s\n", arg.c_str());
+      usage();
+      return 1;
+    }
+  }
+  if (paths.empty()) {
+    usage();
+    return 1;
+  }
+
+  std::vector<Capture> captures(paths.size());
+  std::vector<float> rates(paths.size());
+  double capturedSeconds = 0.0;
+  double meanRate = 0.0;
+  for (size_t i = 0; i < paths.size(); i++) {
+    std::string error;
+    if (!loadCapture(paths[i], captures[i], error)) {
+      fprintf(stderr, "%s\n", error.c_str());
+      return 1;
+    }
+    if (!captures[i].hasReference) {
+      fprintf(stderr, "%s has no reference orientation (qw,qx,qy,qz columns) to score against\n",
+              paths[i].c_str());
+      return 1;
+    }
+    rates[i] = captureSampleRate(captures[i]);
+    capturedSeconds += captures[i].samples.size() / rates[i];
+    meanRate += rates[i] / captures.size();
+    if (fabsf(rates[i] - rates[0]) > 0.02f * rates[0]) {
+      fprintf(stderr, "warning: %s is at %.1f Hz but %s is at %.1f Hz - the results mix both rates\n",
+              paths[i].c_str(), rates[i], paths[0].c_str(), rates[0]);
+    }
+  }
+
+  // the device's hand-picked settings, as the starting point and for comparison
+  const FusionAhrsSettings defaults = IMUFusion::defaultSettings();
+  Candidate start = {};
+  start.values[0] = defaults.gain;
+  start.values[1] = defaults.accelerationRejection;
+  start.values[2] = IMU_FUSION_RECOVERY_SECONDS;
+  start.values[3] = 0.02; // FusionOffset's own cutoff and timeout
+  start.values[4] = 5.0;
+  // exactly as the device runs them at the rate each capture was made at,
+  // like fusion_sweep does
+  double baselineRms = 0.0, baselineMax = 0.0;
+  for (size_t i = 0; i < captures.size(); i++) {
+    const Capture &capture = captures[i];
+    const FusionAhrsSettings deviceSettings = IMUFusion::defaultSettings((unsigned int)(rates[i] + 0.5f));
+    const ReplayScore score = replayCapture(capture, deviceSettings, skipSeconds);
+    baselineRms += score.rmsTiltError / captures.size();
+    baselineMax += score.maxTiltError / captures.size();
+  }
+
+  std::mt19937 rng(seed);
+  std::vector<TuneResult> results;
+  for (unsigned int decimation : decimations) {
+    double mean[PARAMETER_COUNT];
+    double spread[PARAMETER_COUNT];
+    for (int p = 0; p < PARAMETER_COUNT; p++) {
+      mean[p] = log(start.values[p]);
+      // start wide enough to reach most of the range
+      spread[p] = (log(parameters[p].max) - log(parameters[p].min)) / 4.0;
+    }
+    Candidate best = start;
+    best.rmsTiltError = INFINITY;
+    std::vector<Candidate> candidates(population);
+    for (int generation = 0; generation < generations; generation++) {
+      for (size_t c = 0; c < population; c++) {
+        for (int p = 0; p < PARAMETER_COUNT; p++) {
+          // the first candidate is always the current mean
+          const double x = c == 0 ? mean[p] : std::normal_distribution<double>(mean[p], spread[p])(rng);
+          candidates[c].values[p] = std::min(parameters[p].max, std::max(parameters[p].min, exp(x)));
+        }
+      }
+
+      // each worker pulls the next candidate until the generation is done
+      std::atomic<size_t> next(0);
+      auto worker = [&]() {
+        for (size_t i = next++; i < candidates.size(); i = next++) {
+          evaluate(candidates[i], captures, rates, decimation, skipSeconds);
+        }
+      };
+      std::vector<std::thread> workers;
+      for (unsigned int i = 0; i < std::min<size_t>(threadCount, candidates.size()); i++) {
+        workers.emplace_back(worker);
+      }
+      for (std::thread &t : workers) t.join();
+
+      std::sort(candidates.begin(), candidates.end(), [](const Candidate &a, const Candidate &b) {
+        return a.rmsTiltError < b.rmsTiltError;
+      });
+      if (candidates[0].rmsTiltError < best.rmsTiltError) best = candidates[0];
+
+      const size_t elites = std::max<size_t>(2, (size_t)(population * ELITE_FRACTION));
+      for (int p = 0; p < PARAMETER_COUNT; p++) {
+        double sum = 0.0, sumSquares = 0.0;
+        for (size_t e = 0; e < elites; e++) {
+          const double x = log(candidates[e].values[p]);
+          sum += x;
+          sumSquares += x * x;
+        }
+        mean[p] = sum / elites;
+        spread[p] = std::max(MIN_SPREAD, sqrt(std::max(0.0, sumSquares / elites - mean[p] * mean[p])));
+      }
+      fprintf(stderr, "decimation %u generation %d: best rms tilt %.4f deg\n", decimation, generation + 1,
+              best.rmsTiltError);
+    }
+
+    // time the winner on its own so the other workers don't skew it
+    double cpuSeconds = INFINITY;
+    for (int repeat = 0; repeat < 3; repeat++) {
+      Candidate timed = best;
+      const double before = threadCpuSeconds();
+      evaluate(timed, captures, rates, decimation, skipSeconds);
+      cpuSeconds = std::min(cpuSeconds, threadCpuSeconds() - before);
+    }
+    results.push_back({decimation, best, cpuSeconds * 1e6 / capturedSeconds, meanRate / decimation});
+  }
+
+  // cheapest first; a result is on the trade-off curve if nothing cheaper is
+  // at least as accurate
+  std::sort(results.begin(), results.end(), [](const TuneResult &a, const TuneResult &b) {
+    return a.cpuMicrosPerSecond < b.cpuMicrosPerSecond;
+  });
+  printf("decimation,updateHz,cpuUsPerSecond,rmsTiltDeg,maxTiltDeg,gain,accelerationRejection,recoverySeconds,"
+         "offsetCutoffHz,offsetTimeoutS,pareto\n");
+  double bestSoFar = INFINITY;
+  const TuneResult *mostAccurate = nullptr;
+  for (const TuneResult &result : results) {
+    const Candidate &c = result.best;
+    const bool pareto = c.rmsTiltError < bestSoFar;
+    if (pareto) bestSoFar = c.rmsTiltError;
+    if (!mostAccurate || c.rmsTiltError < mostAccurate->best.rmsTiltError) mostAccurate = &result;
+    printf("%u,%.1f,%.1f,%.4f,%.4f,%.4g,%.4g,%.4g,%.4g,%.4g,%s\n", result.decimation,
+           result.updateRate, result.cpuMicrosPerSecond, c.rmsTiltError, c.maxTiltError, c.values[0],
+           c.values[1], c.values[2], c.values[3], c.values[4], pareto ? "true" : "false");
+  }
+
+  const Candidate &c = mostAccurate->best;
+  fprintf(stderr, "device defaults: rms tilt %.4f deg, max %.4f deg\n", baselineRms, baselineMax);
+  fprintf(stderr, "best: decimation %u, rms tilt %.4f deg, max %.4f deg\n", mostAccurate->decimation,
+          c.rmsTiltError, c.maxTiltError);
+  for (int p = 0; p < PARAMETER_COUNT; p++) {
+    fprintf(stderr, "  %s = %.4g\n", parameters[p].name, c.values[p]);
+  }
+  fprintf(stderr, "  (recoveryTriggerPeriod is recoverySeconds times the AHRS update rate, the offset\n"
+                  "  cutoff and timeout go to IMUFusion::offset.setSteadyState)\n");
+  return 0;
+}
@@ -0,0 +1,104 @@
+// WebAssembly entry points for running the firmware's fusion pipeline in the
+// browser. The frontend streams STREAM_RAW samples into a Web Worker, which
+// runs them through IMUFusion (FusionOffset + FusionAhrs, exactly as on the
+// device) so the device only has to send raw data.
+//
+// Build with Emscripten (see tools/README.md):
+//
+//   emcmake cmake -S . -B _wasm_build && cmake --build _wasm_build
+//
+// which writes fusion.js and fusion.wasm to frontend/public/wasm. It also
+// builds natively so the C API can be exercised from the host.
+
+#include "IMUFusion.h"
+#include <stdint.h>
+
+#ifdef __EMSCRIPTEN__
+#include <emscripten.h>
+#else
+#define EMSCRIPTEN_KEEPALIVE
+#endif
+
+// floats written per sample by fusion_process - same order as the BLE packet:
+// ax, ay, az, gx, gy, gz, gyroIntRoll, gyroIntPitch, gyroIntYaw, fusionRoll,
+// fusionPitch, fusionYaw, tempC, timeSec, predictedRoll, predictedPitch,
+// predictedYaw, predictionMs
+#define FUSION_WASM_OUTPUT_LENGTH 18
+// floats read per sample - gx, gy, gz (deg/s, uncorrected), ax, ay, az (g), tempC
+#define FUSION_WASM_INPUT_LENGTH 7
+
+extern "C" {
+
+EMSCRIPTEN_KEEPALIVE IMUFusion *fusion_create(unsigned int sampleRate) {
+  return new IMUFusion(IMUFusion::defaultSettings(sampleRate), sampleRate);
+}
+
+EMSCRIPTEN_KEEPALIVE void fusion_destroy(IMUFusion *fusion) {
+  delete fusion;
+}
+
+// AHRS settings - the rest keep the device's defaults
+EMSCRIPTEN_KEEPALIVE void fusion_configure(IMUFusion *fusion, float gain, float accelerationRejection,
+                                           unsigned int recoveryTriggerPeriod) {
+  fusion->settings.gain = gain;
+  fusion->settings.accelerationRejection = accelerationRejection;
+  fusion->settings.recoveryTriggerPeriod = recoveryTriggerPeriod;
+  FusionAhrsSetSettings(&fusion->g_ahrs, &fusion->settings);
+}
+
+// the samples now come at another rate (Hz) - see IMUFusion::setSampleRate
+EMSCRIPTEN_KEEPALIVE void fusion_set_sample_rate(IMUFusion *fusion, unsigned int sampleRate) {
+  fusion->setSampleRate(sampleRate);
+}
+
+EMSCRIPTEN_KEEPALIVE void fusion_set_gyroscope_range(IMUFusion *fusion, float range) {
+  fusion->setGyroscopeRange(range);
+}
+
+EMSCRIPTEN_KEEPALIVE void fusion_set_prediction_ms(IMUFusion *fusion, float ms) {
+  fusion->predictor.setHorizonMs(ms);
+}
+
+EMSCRIPTEN_KEEPALIVE void fusion_reset_gyro(IMUFusion *fusion) {
+  fusion->resetGyroIntegration();
+}
+
+EMSCRIPTEN_KEEPALIVE void fusion_reset_offset(IMUFusion *fusion) {
+  fusion->offset.reset();
+}
+
+// Runs count samples through the pipeline. timeMicros holds count sample
+// times, samples count * FUSION_WASM_INPUT_LENGTH readings and output gets
+// count * FUSION_WASM_OUTPUT_LENGTH results.
+EMSCRIPTEN_KEEPALIVE void fusion_process(IMUFusion *fusion, const uint32_t *timeMicros, const float *samples,
+                                         int count, float *output) {
+  for (int i = 0; i < count; i++) {
+    const float *in = samples + i * FUSION_WASM_INPUT_LENGTH;
+    const FusionVector gyroscope = {.axis = {.x = in[0], .y = in[1], .z = in[2]}};
+    const FusionVector accelerometer = {.axis = {.x = in[3], .y = in[4], .z = in[5]}};
+    fusion->process(gyroscope, accelerometer, in[6], timeMicros[i]);
+
+    const IMUData data = fusion->getData();
+    float *out = output + i * FUSION_WASM_OUTPUT_LENGTH;
+    out[0] = data.ax;
+    out[1] = data.ay;
+    out[2] = data.az;
+    out[3] = data.gx;
+    out[4] = data.gy;
+    out[5] = data.gz;
+    out[6] = data.accumulatedGyroX;
+    out[7] = data.accumulatedGyroY;
+    out[8] = data.accumulatedGyroZ;
+    out[9] = data.fusionRoll;
+    out[10] = data.fusionPitch;
+    out[11] = data.fusionYaw;
+    out[12] = data.temperatureC;
+    out[13] = data.timeSec;
+    out[14] = data.predictedRoll;
+    out[15] = data.predictedPitch;
+    out[16] = data.predictedYaw;
+    out[17] = data.predictionMs;
+  }
+}
+
+} // extern "C"
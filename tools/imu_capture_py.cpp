@@ -0,0 +1,66 @@
+//
+// imu_capture: Python bindings for CaptureReader. Built when pybind11 is
+// installed (pip install pybind11, then re-run cmake).
+//
+//   import imu_capture
+//   data = imu_capture.load("capture.csv")   # or an imu_hub recording dir
+//   data["time_us"], data["gx"], ...         # NumPy arrays, one per column
+//   data["units"]                            # recordings only - unit names
+//
+// The arrays are views of the reader's memory - nothing is copied, and a
+// recording's columns stay memory mapped from their files. They keep the
+// reader alive between them, so it's freed with the last one.
+//
+
+#include "CaptureReader.h"
+#include <memory>
+#include <pybind11/numpy.h>
+#include <pybind11/pybind11.h>
+#include <pybind11/stl.h>
+
+namespace py = pybind11;
+
+static py::dtype columnDtype(ColumnType type) {
+  switch (type) {
+  case COLUMN_F32:
+    return py::dtype::of<float>();
+  case COLUMN_I64:
+    return py::dtype::of<int64_t>();
+  case COLUMN_U32:
+    return py::dtype::of<uint32_t>();
+  case COLUMN_U16:
+    return py::dtype::of<uint16_t>();
+  }
+  throw std::logic_error("unknown column type");
+}
+
+static py::dict load(const std::string &path, unsigned int threads) {
+  std::shared_ptr<CaptureReader> reader = std::make_shared<CaptureReader>();
+  std::string error;
+  bool ok;
+  {
+    // parsing is all C++, other Python threads can run meanwhile
+    py::gil_scoped_release release;
+    ok = reader->open(path, error, threads);
+  }
+  if (!ok) throw std::runtime_error(error);
+
+  // every array's base owns a reference to the reader
+  py::capsule owner(new std::shared_ptr<CaptureReader>(reader),
+                    [](void *p) { delete static_cast<std::shared_ptr<CaptureReader> *>(p); });
+  py::dict result;
+  for (const CaptureColumn &column : reader->columns()) {
+    const py::dtype dtype = columnDtype(column.type);
+    result[column.name.c_str()] = py::array(dtype, {(py::ssize_t)reader->length()}, {dtype.itemsize()},
+                                            column.data, owner);
+  }
+  if (!reader->unitNames().empty()) result["units"] = reader->unitNames();
+  return result;
+}
+
+PYBIND11_MODULE(imu_capture, m) {
+  m.doc() = "Zero-copy loader for ESP32-LSM6DS3 captures and imu_hub recordings";
+  m.def("load", &load, py::arg("path"), py::arg("threads") = 0,
+        "Load a STREAM_RAW or JSON capture, or an imu_hub recording directory, as a dict of NumPy arrays. "
+        "threads=0 parses text on all cores.");
+}
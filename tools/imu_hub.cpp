@@ -0,0 +1,563 @@
+//
+// imu_hub: read STREAM_RAW samples from many units at once - USB serial ports
+// and UDP senders - put them all on one timeline and write a single merged,
+// time-ordered stream (CSV on stdout) or a columnar recording.
+//
+// usage: imu_hub [options] SOURCE [SOURCE ...]
+//   SOURCE              serial:/dev/ttyACM0 or udp:PORT (every sender on the
+//                       port is a separate unit, one or more lines per datagram)
+//   --record DIR        write a columnar recording to DIR instead of CSV
+//   --latency MS        how long to hold samples back for ordering (default 50)
+//   --stats SECONDS     per-unit statistics on stderr this often (default 5, 0 off)
+//
+// Linux only (epoll). Ctrl-C flushes and stops.
+//
+
+#include "Capture.h"
+#include <algorithm>
+#include <arpa/inet.h>
+#include <deque>
+#include <errno.h>
+#include <fcntl.h>
+#include <map>
+#include <netinet/in.h>
+#include <queue>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+// how fast a unit's clock offset estimate may creep later, to follow drift
+// and recover from one unusually early packet (microseconds per second)
+#define HUB_OFFSET_CREEP 2000
+// sync edges kept per unit for matching
+#define HUB_SYNC_HISTORY 16
+// edges of the same pulse have to land within this of each other on the host
+// clock to be matched - well under the pulse period
+#define HUB_SYNC_WINDOW_US 100000
+// a serial port that goes away is retried this often
+#define HUB_REOPEN_INTERVAL_US 1000000
+// more than this many sample intervals between samples counts as a gap
+#define HUB_GAP_FACTOR 1.5
+
+static volatile sig_atomic_t stopping = 0;
+
+static int64_t monotonicMicros() {
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+// One device. Its clock is mapped onto the host clock using the smallest
+// arrival delay seen (the samples that got through fastest); once it has
+// seen the same sync pulse as the reference unit, it's mapped onto the
+// reference unit's clock instead, which is good to a few microseconds.
+struct Unit {
+  std::string name;
+  // device time unwrapped to 64 bits - microseconds
+  bool started = false;
+  uint32_t lastRaw = 0;
+  int64_t device = 0;
+  // host minus device time for the fastest samples - microseconds
+  bool hasOffset = false;
+  int64_t offset = 0;
+  int64_t lastArrival = 0;
+  // smoothed sample interval - microseconds
+  double interval = 0.0;
+  // device time of recent sync edges
+  std::deque<int64_t> edges;
+  bool outputEdgesOnly = true;
+  // add to device time to get the reference unit's device time
+  bool synced = false;
+  int64_t syncOffset = 0;
+  // lines of a trigger burst still to skip
+  unsigned long burstLines = 0;
+  // counters - totals and at the last stats line
+  uint64_t samples = 0;
+  uint64_t missed = 0;
+  uint64_t late = 0;
+  uint64_t resets = 0;
+  uint64_t samplesAtStats = 0;
+
+  // the device rebooted - start the clock model again
+  void resetClock() {
+    started = false;
+    hasOffset = false;
+    interval = 0.0;
+    edges.clear();
+    synced = false;
+    resets++;
+  }
+
+  // unwraps micros(), returns false if the clock went backwards
+  bool unwrap(uint32_t raw) {
+    if (!started) {
+      started = true;
+      device = raw;
+    } else {
+      const uint32_t delta = raw - lastRaw;
+      if (delta > 0x80000000u) return false;
+      device += delta;
+    }
+    lastRaw = raw;
+    return true;
+  }
+
+  void updateOffset(int64_t deviceMicros, int64_t hostMicros) {
+    const int64_t candidate = hostMicros - deviceMicros;
+    if (!hasOffset) {
+      hasOffset = true;
+      offset = candidate;
+    } else {
+      const int64_t creep = (hostMicros - lastArrival) * HUB_OFFSET_CREEP / 1000000;
+      offset = std::min(offset + std::max<int64_t>(0, creep), candidate);
+    }
+    lastArrival = hostMicros;
+  }
+};
+
+struct MergedSample {
+  // hub time - microseconds since the hub started
+  int64_t time;
+  uint16_t unit;
+  uint32_t deviceMicros;
+  CaptureSample sample;
+};
+
+struct LaterFirst {
+  bool operator()(const MergedSample &a, const MergedSample &b) const {
+    return a.time > b.time;
+  }
+};
+
+// A serial port (one unit) or a UDP socket (one unit per sender)
+struct Source {
+  bool udp = false;
+  std::string path;
+  int port = 0;
+  int fd = -1;
+  // serial only
+  int unit = -1;
+  std::string pending;
+  int64_t retryAt = 0;
+  std::map<std::string, int> peers;
+};
+
+// One file per column of little-endian values, so a recording can be mapped
+// straight into arrays: time_us.i64 unit.u16 device_us.u32 gx.f32 gy.f32
+// gz.f32 ax.f32 ay.f32 az.f32 temp.f32, plus units.csv naming each unit index.
+class ColumnarWriter {
+private:
+  std::string dir;
+  FILE *files[10] = {};
+
+public:
+  bool open(const std::string &dir) {
+    this->dir = dir;
+    mkdir(dir.c_str(), 0755);
+    static const char *const names[10] = {"time_us.i64", "unit.u16", "device_us.u32", "gx.f32", "gy.f32",
+                                          "gz.f32",      "ax.f32",   "ay.f32",        "az.f32", "temp.f32"};
+    for (int i = 0; i < 10; i++) {
+      files[i] = fopen((dir + "/" + names[i]).c_str(), "wb");
+      if (!files[i]) return false;
+    }
+    return true;
+  }
+
+  void write(const MergedSample &merged) {
+    const CaptureSample &s = merged.sample;
+    fwrite(&merged.time, sizeof(merged.time), 1, files[0]);
+    fwrite(&merged.unit, sizeof(merged.unit), 1, files[1]);
+    fwrite(&merged.deviceMicros, sizeof(merged.deviceMicros), 1, files[2]);
+    const float values[7] = {s.gyroscope.axis.x,     s.gyroscope.axis.y,     s.gyroscope.axis.z, s.accelerometer.axis.x,
+                             s.accelerometer.axis.y, s.accelerometer.axis.z, s.temperatureC};
+    for (int i = 0; i < 7; i++) fwrite(&values[i], sizeof(float), 1, files[3 + i]);
+  }
+
+  void close(const std::vector<Unit> &units) {
+    for (FILE *&file : files) {
+      if (file) fclose(file);
+      file = nullptr;
+    }
+    FILE *index = fopen((dir + "/units.csv").c_str(), "w");
+    if (!index) return;
+    fprintf(index, "unit,name,samples,missed,late,synced\n");
+    for (size_t i = 0; i < units.size(); i++) {
+      fprintf(index, "%zu,%s,%llu,%llu,%llu,%s\n", i, units[i].name.c_str(), (unsigned long long)units[i].samples,
+              (unsigned long long)units[i].missed, (unsigned long long)units[i].late,
+              units[i].synced ? "true" : "false");
+    }
+    fclose(index);
+  }
+};
+
+class Hub {
+private:
+  int epoll = -1;
+  std::vector<Source> sources;
+  std::vector<Unit> units;
+  // unit whose clock the synced units are put on, -1 until one sees a pulse
+  int reference = -1;
+  int64_t startMicros = 0;
+  int64_t latencyMicros = 50000;
+  int64_t lastEmitted = INT64_MIN;
+  std::priority_queue<MergedSample, std::vector<MergedSample>, LaterFirst> queue;
+  ColumnarWriter *writer = nullptr;
+
+  int addUnit(const std::string &name) {
+    Unit unit;
+    unit.name = name;
+    units.push_back(unit);
+    return (int)units.size() - 1;
+  }
+
+  bool openSerial(Source &source) {
+    source.fd = ::open(source.path.c_str(), O_RDWR | O_NOCTTY | O_NONBLOCK);
+    if (source.fd < 0) return false;
+    termios tty;
+    if (tcgetattr(source.fd, &tty) == 0) {
+      cfmakeraw(&tty);
+      // USB CDC ignores it, but a UART bridge wouldn't
+      cfsetspeed(&tty, B460800);
+      tcsetattr(source.fd, TCSANOW, &tty);
+    }
+    // the hub only understands the raw CSV stream
+    const char command[] = "STREAM_RAW\n";
+    if (::write(source.fd, command, sizeof(command) - 1) < 0) {
+      fprintf(stderr, "%s: %s\n", source.path.c_str(), strerror(errno));
+    }
+    source.pending.clear();
+    // a burst cut off by the unplug won't be finished
+    units[source.unit].burstLines = 0;
+    epoll_event event = {};
+    event.events = EPOLLIN;
+    event.data.u64 = &source - sources.data();
+    epoll_ctl(epoll, EPOLL_CTL_ADD, source.fd, &event);
+    return true;
+  }
+
+  void closeSerial(Source &source, int64_t now) {
+    epoll_ctl(epoll, EPOLL_CTL_DEL, source.fd, nullptr);
+    ::close(source.fd);
+    source.fd = -1;
+    source.retryAt = now + HUB_REOPEN_INTERVAL_US;
+    fprintf(stderr, "%s: disconnected\n", source.path.c_str());
+  }
+
+  bool openUdp(Source &source) {
+    source.fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+    if (source.fd < 0) return false;
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_ANY);
+    address.sin_port = htons(source.port);
+    if (bind(source.fd, (sockaddr *)&address, sizeof(address)) < 0) return false;
+    epoll_event event = {};
+    event.events = EPOLLIN;
+    event.data.u64 = &source - sources.data();
+    epoll_ctl(epoll, EPOLL_CTL_ADD, source.fd, &event);
+    return true;
+  }
+
+  // tries to line unit up with the reference unit using its newest edge
+  void matchSync(int index) {
+    Unit &unit = units[index];
+    const Unit &ref = units[reference];
+    if (index == reference || unit.edges.empty() || !unit.hasOffset || !ref.hasOffset) return;
+    const int64_t edge = unit.edges.back();
+    const int64_t host = edge + unit.offset;
+    for (int64_t refEdge : ref.edges) {
+      if (llabs(refEdge + ref.offset - host) < HUB_SYNC_WINDOW_US) {
+        unit.syncOffset = refEdge - edge;
+        unit.synced = true;
+        return;
+      }
+    }
+  }
+
+  void handleSyncEdge(int index, const std::string &line, unsigned long edgeMicros) {
+    Unit &unit = units[index];
+    // a master that doesn't see its own pulses only has output edges
+    const bool input = line.find("\"id\":0,") != std::string::npos;
+    if (input && unit.outputEdgesOnly) {
+      unit.outputEdgesOnly = false;
+      unit.edges.clear();
+    }
+    if (!input && !unit.outputEdgesOnly) return;
+    if (!unit.started) return;
+    // event times are raw micros() too - put them on the unwrapped clock
+    unit.edges.push_back(unit.device + (int32_t)((uint32_t)edgeMicros - unit.lastRaw));
+    if (unit.edges.size() > HUB_SYNC_HISTORY) unit.edges.pop_front();
+    if (reference < 0) {
+      reference = index;
+      unit.synced = true;
+      unit.syncOffset = 0;
+    }
+    if (index == reference) {
+      for (size_t i = 0; i < units.size(); i++) matchSync((int)i);
+    } else {
+      matchSync(index);
+    }
+  }
+
+  void handleLine(int index, const std::string &line, int64_t now) {
+    Unit &unit = units[index];
+    unsigned long value;
+    if (parseBurstHeader(line, value)) {
+      unit.burstLines = value;
+      return;
+    }
+    if (unit.burstLines > 0) {
+      unit.burstLines--;
+      return;
+    }
+    if (line.find("\"type\":\"SYNC\"") != std::string::npos && findJsonNumber(line, "us", value)) {
+      handleSyncEdge(index, line, value);
+      return;
+    }
+    MergedSample merged;
+    bool referenced;
+    if (!parseCaptureLine(line, merged.sample, referenced)) return;
+    const uint32_t raw = merged.sample.timeMicros;
+    const int64_t previous = unit.device;
+    const bool wasStarted = unit.started;
+    if (!unit.unwrap(raw)) {
+      unit.resetClock();
+      if (index == reference) {
+        // everyone was lined up on this clock - start again with a new reference
+        reference = -1;
+        for (Unit &other : units) other.synced = false;
+      }
+      unit.unwrap(raw);
+    } else if (wasStarted) {
+      const double dt = (double)(unit.device - previous);
+      if (unit.interval > 0.0 && dt > HUB_GAP_FACTOR * unit.interval) {
+        unit.missed += (uint64_t)(dt / unit.interval + 0.5) - 1;
+      } else {
+        unit.interval = unit.interval == 0.0 ? dt : unit.interval + (dt - unit.interval) * 0.05;
+      }
+    }
+    unit.updateOffset(unit.device, now);
+    unit.samples++;
+
+    int64_t host = unit.device + unit.offset;
+    if (unit.synced && reference >= 0) {
+      host = unit.device + unit.syncOffset + units[reference].offset;
+    }
+    merged.time = host - startMicros;
+    merged.unit = (uint16_t)index;
+    merged.deviceMicros = raw;
+    if (merged.time < lastEmitted) {
+      // arrived after later samples were already written
+      unit.late++;
+      return;
+    }
+    queue.push(merged);
+  }
+
+  void handleLines(int index, std::string &pending, const char *data, size_t length, int64_t now) {
+    pending.append(data, length);
+    size_t start = 0;
+    size_t end;
+    while ((end = pending.find('\n', start)) != std::string::npos) {
+      std::string line = pending.substr(start, end - start);
+      if (!line.empty() && line.back() == '\r') line.pop_back();
+      handleLine(index, line, now);
+      start = end + 1;
+    }
+    pending.erase(0, start);
+  }
+
+  void readSource(Source &source, int64_t now) {
+    char buffer[65536];
+    if (!source.udp) {
+      while (true) {
+        const ssize_t n = read(source.fd, buffer, sizeof(buffer));
+        if (n > 0) {
+          handleLines(source.unit, source.pending, buffer, n, now);
+          continue;
+        }
+        if (n < 0 && (errno == EAGAIN || errno == EINTR)) return;
+        // unplugged (EIO) or closed
+        closeSerial(source, now);
+        return;
+      }
+    }
+    while (true) {
+      sockaddr_in peer;
+      socklen_t peerLength = sizeof(peer);
+      const ssize_t n = recvfrom(source.fd, buffer, sizeof(buffer), 0, (sockaddr *)&peer, &peerLength);
+      if (n < 0) return;
+      char address[INET_ADDRSTRLEN];
+      inet_ntop(AF_INET, &peer.sin_addr, address, sizeof(address));
+      const std::string name = std::string(address) + ":" + std::to_string(ntohs(peer.sin_port));
+      auto found = source.peers.find(name);
+      const int unit = found != source.peers.end() ? found->second : (source.peers[name] = addUnit(name));
+      // a datagram is whole lines - don't carry anything over
+      std::string pending;
+      handleLines(unit, pending, buffer, n, now);
+      if (!pending.empty()) handleLine(unit, pending, now);
+    }
+  }
+
+  void emit(const MergedSample &merged) {
+    lastEmitted = merged.time;
+    if (writer) {
+      writer->write(merged);
+      return;
+    }
+    const CaptureSample &s = merged.sample;
+    printf("%lld,%u,%u,%g,%g,%g,%g,%g,%g,%g\n", (long long)merged.time, merged.unit, merged.deviceMicros,
+           s.gyroscope.axis.x, s.gyroscope.axis.y, s.gyroscope.axis.z, s.accelerometer.axis.x,
+           s.accelerometer.axis.y, s.accelerometer.axis.z, s.temperatureC);
+  }
+
+  // everything older than the latency window is final - write it in order
+  void flush(int64_t now, bool all) {
+    const int64_t watermark = now - startMicros - latencyMicros;
+    while (!queue.empty() && (all || queue.top().time <= watermark)) {
+      emit(queue.top());
+      queue.pop();
+    }
+    if (!writer) fflush(stdout);
+  }
+
+  void printStats(double seconds) {
+    fprintf(stderr, "{\"hub\":{\"queued\":%zu,\"units\":[", queue.size());
+    for (size_t i = 0; i < units.size(); i++) {
+      Unit &unit = units[i];
+      fprintf(stderr, "%s{\"name\":\"%s\",\"samples\":%llu,\"rate\":%.1f,\"missed\":%llu,\"late\":%llu,"
+              "\"resets\":%llu,\"synced\":%s}",
+              i ? "," : "", unit.name.c_str(), (unsigned long long)unit.samples,
+              seconds > 0 ? (unit.samples - unit.samplesAtStats) / seconds : 0.0, (unsigned long long)unit.missed,
+              (unsigned long long)unit.late, (unsigned long long)unit.resets, unit.synced ? "true" : "false");
+      unit.samplesAtStats = unit.samples;
+    }
+    fprintf(stderr, "]}}\n");
+  }
+
+public:
+  Hub(int64_t latencyMicros, ColumnarWriter *writer) : latencyMicros(latencyMicros), writer(writer) {
+    epoll = epoll_create1(0);
+    startMicros = monotonicMicros();
+  }
+
+  // serial:/dev/ttyACM0 or udp:PORT
+  bool add(const std::string &spec) {
+    Source source;
+    if (spec.compare(0, 7, "serial:") == 0) {
+      source.path = spec.substr(7);
+      source.unit = addUnit(source.path);
+    } else if (spec.compare(0, 4, "udp:") == 0) {
+      source.udp = true;
+      source.port = atoi(spec.c_str() + 4);
+      if (source.port <= 0 || source.port > 65535) return false;
+    } else {
+      return false;
+    }
+    sources.push_back(source);
+    return true;
+  }
+
+  int run(double statsSeconds) {
+    if (!writer) printf("time_us,unit,device_us,gx,gy,gz,ax,ay,az,temp\n");
+    // sources is fixed from here on, so indices are safe epoll keys
+    for (Source &source : sources) {
+      const bool ok = source.udp ? openUdp(source) : openSerial(source);
+      if (!ok) {
+        fprintf(stderr, "%s: %s\n", source.udp ? ("udp:" + std::to_string(source.port)).c_str() : source.path.c_str(),
+                strerror(errno));
+        if (source.udp) return 1;
+        source.retryAt = monotonicMicros() + HUB_REOPEN_INTERVAL_US;
+      }
+    }
+    int64_t nextStats = monotonicMicros() + (int64_t)(statsSeconds * 1e6);
+    int64_t lastStats = monotonicMicros();
+    epoll_event events[64];
+    while (!stopping) {
+      const int count = epoll_wait(epoll, events, 64, 10);
+      const int64_t now = monotonicMicros();
+      for (int i = 0; i < count; i++) {
+        readSource(sources[events[i].data.u64], now);
+      }
+      for (Source &source : sources) {
+        if (!source.udp && source.fd < 0 && now >= source.retryAt) {
+          if (openSerial(source)) {
+            fprintf(stderr, "%s: connected\n", source.path.c_str());
+          } else {
+            source.retryAt = now + HUB_REOPEN_INTERVAL_US;
+          }
+        }
+      }
+      flush(now, false);
+      if (statsSeconds > 0 && now >= nextStats) {
+        printStats((now - lastStats) / 1e6);
+        lastStats = now;
+        nextStats = now + (int64_t)(statsSeconds * 1e6);
+      }
+    }
+    flush(monotonicMicros(), true);
+    printStats((monotonicMicros() - lastStats) / 1e6);
+    if (writer) writer->close(units);
+    return 0;
+  }
+};
+
+static void usage() {
+  fprintf(stderr, "usage: imu_hub [--record DIR] [--latency MS] [--stats SECONDS] SOURCE...\n"
+                  "SOURCE is serial:/dev/ttyACM0 or udp:PORT\n");
+}
+
+int main(int argc, char **argv) {
+  const char *recordDir = nullptr;
+  double latencyMs = 50.0;
+  double statsSeconds = 5.0;
+  std::vector<std::string> specs;
+  for (int i = 1; i < argc; i++) {
+    const std::string arg = argv[i];
+    const bool hasValue = i + 1 < argc;
+    if (arg == "--record" && hasValue) {
+      recordDir = argv[++i];
+    } else if (arg == "--latency" && hasValue) {
+      latencyMs = strtod(argv[++i], nullptr);
+    } else if (arg == "--stats" && hasValue) {
+      statsSeconds = strtod(argv[++i], nullptr);
+    } else if (arg[0] == '-') {
+      fprintf(stderr, "bad argument: %s\n", arg.c_str());
+      usage();
+      return 1;
+    } else {
+      specs.push_back(arg);
+    }
+  }
+  if (specs.empty()) {
+    usage();
+    return 1;
+  }
+
+  ColumnarWriter writer;
+  if (recordDir && !writer.open(recordDir)) {
+    fprintf(stderr, "cannot write to %s\n", recordDir);
+    return 1;
+  }
+  Hub hub((int64_t)(latencyMs * 1000.0), recordDir ? &writer : nullptr);
+  for (const std::string &spec : specs) {
+    if (!hub.add(spec)) {
+      fprintf(stderr, "bad source: %s\n", spec.c_str());
+      usage();
+      return 1;
+    }
+  }
+
+  // no SA_RESTART so epoll_wait returns and the loop sees the flag
+  struct sigaction action = {};
+  action.sa_handler = [](int) { stopping = 1; };
+  sigaction(SIGINT, &action, nullptr);
+  sigaction(SIGTERM, &action, nullptr);
+  return hub.run(statsSeconds);
+}